@@ -27,6 +27,23 @@
 #include "cs/csendian.h"
 #include "cs/archive.h"
 
+#if defined (OS_LINUX)
+#  define CS_ARCHIVE_MMAP
+#  define CS_ARCHIVE_PREAD
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#endif
+
+// Seek and read of the fallback path share file position, the stream is
+// locked so reads of several threads don't interleave
+#if defined (OS_WIN32)
+#  define CS_LOCK_FILE(f) _lock_file (f)
+#  define CS_UNLOCK_FILE(f) _unlock_file (f)
+#else
+#  define CS_LOCK_FILE(f) flockfile (f)
+#  define CS_UNLOCK_FILE(f) funlockfile (f)
+#endif
+
 // Default compression method to use when adding entries (there is no choice for now)
 #ifndef DEFAULT_COMPRESSION_METHOD
 #  define DEFAULT_COMPRESSION_METHOD ZIP_DEFLATE
@@ -53,32 +70,114 @@ char csArchive::hdr_extlocal[4] = {'P', 'K', EXTD_LOCAL_SIG};
 
 //-- Archive class implementation -------------------------------------------
 
-csArchive::csArchive (const char *filename)
+csArchive::csArchive (const char *filename, OpenMode mode)
 {
   comment = NULL;
   comment_length = 0;
   csArchive::filename = strnew (filename);
+  csArchive::mode = mode;
+  map_base = NULL;
+  map_size = 0;
+  hash = NULL;
+  hash_size = 0;
+  dir_found = false;
 
   file = fopen (filename, "rb");
   if (!file)       			/* Create new archive file */
     file = fopen (filename, "wb");
   else
+  {
+    if (mode == omMapped)
+      MapArchive ();
     ReadDirectory ();
+  }
 }
 
 csArchive::~csArchive ()
 {
+  UnmapArchive ();
+  free (hash);
   free (filename);
   delete [] comment;
   if (file) fclose (file);
 }
 
+bool csArchive::MapArchive ()
+{
+#ifdef CS_ARCHIVE_MMAP
+  struct stat st;
+
+  if (!file || map_base)
+    return (map_base != NULL);
+  if (fstat (fileno (file), &st) || (st.st_size <= 0))
+    return false;               /* Nothing to map */
+
+  void *image = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno (file), 0);
+  if (image == MAP_FAILED)
+    return false;
+
+  map_base = (char *)image;
+  map_size = st.st_size;
+  return true;
+#else
+  return false;
+#endif
+}
+
+void csArchive::UnmapArchive ()
+{
+#ifdef CS_ARCHIVE_MMAP
+  if (map_base)
+    munmap (map_base, map_size);
+#endif
+  map_base = NULL;
+  map_size = 0;
+}
+
 void csArchive::ReadDirectory ()
 {
   if (dir.Length ())
     return;                     /* Directory already read */
 
-  ReadZipDirectory (file);
+  if (map_base)
+    ReadZipDirectory (map_base, map_size);
+  else
+    ReadZipDirectory (file);
+  BuildHash ();
+}
+
+unsigned int csArchive::HashName (const char *name)
+{
+  /* FNV-1a */
+  unsigned int h = 2166136261U;
+  while (*name)
+    h = (h ^ (unsigned char)*name++) * 16777619U;
+  return h;
+}
+
+void csArchive::BuildHash ()
+{
+  int n, size = 16;
+
+  free (hash);
+  hash = NULL;
+  hash_size = 0;
+
+  /* Keep the index at most half full */
+  while (size < dir.Length () * 2)
+    size *= 2;
+  if (!(hash = (ArchiveEntry **)calloc (size, sizeof (ArchiveEntry *))))
+    return;                     /* FindName falls back to binary search */
+  hash_size = size;
+
+  for (n = 0; n < dir.Length (); n++)
+  {
+    ArchiveEntry *e = dir.Get (n);
+    unsigned int slot = HashName (e->filename) & (hash_size - 1);
+    while (hash [slot])
+      slot = (slot + 1) & (hash_size - 1);
+    hash [slot] = e;
+  }
 }
 
 void csArchive::ReadZipDirectory (FILE *infile)
@@ -138,7 +237,10 @@ void csArchive::ReadZipDirectory (FILE *infile)
              || (memcmp (buff, hdr_central, sizeof (hdr_central)) != 0))
             {
               if (dir.Length ())
+              {
+                dir_found = true;
                 return;         /* Finished reading central directory */
+              }
               else
                 goto rebuild_cdr;       /* Broken central directory */
             }
@@ -218,6 +320,122 @@ void csArchive::ReadZipEntries (FILE *infile)
   } /* endwhile */
 }
 
+void csArchive::ReadZipDirectory (const char *image, size_t size)
+{
+  ZIP_end_central_dir_record ecdr;
+  ZIP_central_directory_file_header cdfh;
+  char buff[1024];              /* Entry name buffer */
+  size_t step = ZIP_END_CENTRAL_DIR_RECORD_SIZE + sizeof (hdr_endcentral);
+  const char *search_ptr, *min_ptr, *cur_ptr, *end_ptr = image + size;
+
+  if (size < step)
+    goto rebuild_cdr;
+
+  if (size >= 65535 + step)
+    min_ptr = end_ptr - (65535 + step);
+  else
+    min_ptr = image;
+
+  /* Same as above, but the whole tail of the file is already in memory */
+  for (search_ptr = end_ptr - step; search_ptr >= min_ptr; search_ptr--)
+    if ((*search_ptr == 'P') &&
+        (memcmp (search_ptr, hdr_endcentral, sizeof (hdr_endcentral)) == 0))
+    {
+      LoadECDR (ecdr, (char *)&search_ptr[sizeof (hdr_endcentral)]);
+      if ((size_t)(end_ptr - search_ptr) < step + ecdr.zipfile_comment_length
+       || !ReadArchiveComment (search_ptr + step, ecdr.zipfile_comment_length)
+       || ecdr.offset_start_central_directory >= size)
+        goto rebuild_cdr;       /* Broken central directory */
+
+      cur_ptr = image + ecdr.offset_start_central_directory;
+      for (;;)
+      {
+        if ((end_ptr - cur_ptr < (long)(sizeof (hdr_central) + ZIP_CENTRAL_DIRECTORY_FILE_HEADER_SIZE))
+         || (memcmp (cur_ptr, hdr_central, sizeof (hdr_central)) != 0))
+        {
+          if (dir.Length ())
+          {
+            dir_found = true;
+            return;             /* Finished reading central directory */
+          }
+          else
+            goto rebuild_cdr;   /* Broken central directory */
+        }
+        LoadCDFH (cdfh, (char *)cur_ptr + sizeof (hdr_central));
+        cur_ptr += sizeof (hdr_central) + ZIP_CENTRAL_DIRECTORY_FILE_HEADER_SIZE;
+
+        if ((cdfh.filename_length >= sizeof (buff))
+         || (end_ptr - cur_ptr < (long)(cdfh.filename_length + cdfh.extra_field_length
+                                        + cdfh.file_comment_length)))
+          return;               /* Broken zipfile? */
+        memcpy (buff, cur_ptr, cdfh.filename_length);
+        buff[cdfh.filename_length] = 0;
+        cur_ptr += cdfh.filename_length;
+
+        if ((buff[cdfh.filename_length - 1] == PATH_SEPARATOR)
+         || (buff[cdfh.filename_length - 1] == PATH_SEPARATOR_2))
+        {
+          cur_ptr += cdfh.extra_field_length + cdfh.file_comment_length;
+          continue;
+        } /* endif */
+
+        ArchiveEntry *curentry = InsertEntry (buff, cdfh);
+        curentry->ReadExtraField (cur_ptr, cdfh.extra_field_length);
+        cur_ptr += cdfh.extra_field_length;
+        curentry->ReadFileComment (cur_ptr, cdfh.file_comment_length);
+        cur_ptr += cdfh.file_comment_length;
+      } /* endfor */
+    } /* endif */
+
+rebuild_cdr:
+  ReadZipEntries (image, size);
+}
+
+void csArchive::ReadZipEntries (const char *image, size_t size)
+{
+  size_t cur_offs = 0, new_offs;
+  char buff[1024];
+  ZIP_central_directory_file_header cdfh;
+  ZIP_local_file_header lfh;
+
+  while ((cur_offs + sizeof (hdr_local) + ZIP_LOCAL_FILE_HEADER_SIZE <= size)
+         && (memcmp (image + cur_offs, hdr_local, sizeof (hdr_local)) == 0))
+  {
+    const char *cur_ptr = image + cur_offs + sizeof (hdr_local);
+
+    LoadLFH (lfh, (char *)cur_ptr);
+    cur_ptr += ZIP_LOCAL_FILE_HEADER_SIZE;
+    new_offs = cur_offs + sizeof (hdr_local) + ZIP_LOCAL_FILE_HEADER_SIZE +
+      lfh.filename_length + lfh.extra_field_length + lfh.csize;
+    if ((lfh.filename_length >= sizeof (buff))
+        || (new_offs > size))
+      return;                   /* Broken zipfile? */
+    memcpy (buff, cur_ptr, lfh.filename_length);
+    buff[lfh.filename_length] = 0;
+
+    if ((buff[lfh.filename_length - 1] != '/')
+        && (buff[lfh.filename_length - 1] != PATH_SEPARATOR))
+    {
+      /* Partialy convert lfh to cdfh */
+      memset (&cdfh, 0, sizeof (cdfh));
+      cdfh.version_needed_to_extract[0] = lfh.version_needed_to_extract[0];
+      cdfh.version_needed_to_extract[1] = lfh.version_needed_to_extract[1];
+      cdfh.general_purpose_bit_flag = lfh.general_purpose_bit_flag;
+      cdfh.compression_method = lfh.compression_method;
+      cdfh.last_mod_file_time = lfh.last_mod_file_time;
+      cdfh.last_mod_file_date = lfh.last_mod_file_date;
+      cdfh.crc32 = lfh.crc32;
+      cdfh.csize = lfh.csize;
+      cdfh.ucsize = lfh.ucsize;
+      cdfh.relative_offset_local_header = cur_offs;
+
+      ArchiveEntry *curentry = InsertEntry (buff, cdfh);
+      curentry->ReadExtraField (cur_ptr + lfh.filename_length, lfh.extra_field_length);
+    } /* endif */
+    cur_offs = new_offs;
+  } /* endwhile */
+}
+
 csArchive::ArchiveEntry *csArchive::InsertEntry (const char *name,
   ZIP_central_directory_file_header &cdfh)
 {
@@ -244,6 +462,22 @@ bool csArchive::ReadArchiveComment (FILE *infile, size_t zipfile_comment_length)
   return (fread (comment, 1, zipfile_comment_length, infile) == zipfile_comment_length);
 }
 
+bool csArchive::ReadArchiveComment (const char *src, size_t zipfile_comment_length)
+{
+  if (comment && (comment_length != zipfile_comment_length))
+  {
+    delete [] comment;
+    comment = NULL;
+  }
+  if (!(comment_length = zipfile_comment_length))
+    return true;
+
+  if (!comment)
+    comment = new char [zipfile_comment_length];
+  memcpy (comment, src, zipfile_comment_length);
+  return true;
+}
+
 void csArchive::Dir () const
 {
   printf (" Comp |Uncomp| File |CheckSum| File\n");
@@ -259,6 +493,15 @@ void csArchive::Dir () const
 
 void *csArchive::FindName (const char *name) const
 {
+  if (hash)
+  {
+    unsigned int slot = HashName (name) & (hash_size - 1);
+    for (; hash [slot]; slot = (slot + 1) & (hash_size - 1))
+      if (strcmp (hash [slot]->filename, name) == 0)
+        return hash [slot];
+    return NULL;
+  }
+
   int idx = dir.FindSortedKey (name);
   if (idx < 0)
     return NULL;
@@ -267,37 +510,173 @@ void *csArchive::FindName (const char *name) const
 
 char *csArchive::Read (const char *name, size_t *size)
 {
-  ArchiveEntry *f = (ArchiveEntry *) FindName (name);
+  return Read (FindName (name), size);
+}
+
+char *csArchive::Read (void *entry, size_t *size)
+{
+  ArchiveEntry *f = (ArchiveEntry *) entry;
 
   if (!f)
     return NULL;
   if (size)
     *size = f->info.ucsize;
 
+  if (map_base)
+    return ReadEntry (f);
   return ReadEntry (file, f);
 }
 
+bool csArchive::ReadAt (FILE *infile, size_t offs, void *data, size_t size) const
+{
+#ifdef CS_ARCHIVE_PREAD
+  // Positional read: the shared file position is never touched
+  char *ptr = (char *)data;
+  while (size)
+  {
+    ssize_t done = pread (fileno (infile), ptr, size, offs);
+    if (done <= 0)
+      return false;
+    ptr += done;
+    offs += done;
+    size -= done;
+  }
+  return true;
+#else
+  bool ok;
+  CS_LOCK_FILE (infile);
+  ok = !fseek (infile, offs, SEEK_SET)
+    && (fread (data, 1, size, infile) == size);
+  CS_UNLOCK_FILE (infile);
+  return ok;
+#endif
+}
+
+size_t csArchive::GetDataOffset (FILE *infile, ArchiveEntry *f) const
+{
+  // Validate the local header of the entry and return offset of its data
+  char buff[sizeof (hdr_local) + ZIP_LOCAL_FILE_HEADER_SIZE];
+  ZIP_local_file_header lfh;
+
+  if (!ReadAt (infile, f->info.relative_offset_local_header, buff, sizeof (buff))
+      || (memcmp (buff, hdr_local, sizeof (hdr_local)) != 0))
+    return 0;
+
+  LoadLFH (lfh, buff + sizeof (hdr_local));
+  return f->info.relative_offset_local_header + sizeof (buff) +
+    lfh.filename_length + lfh.extra_field_length;
+}
+
+const char *csArchive::GetView (void *entry, size_t *size) const
+{
+  ArchiveEntry *f = (ArchiveEntry *) entry;
+
+  if (!f
+      || (f->info.compression_method != ZIP_STORE)
+      || (f->info.csize != f->info.ucsize))
+    return NULL;
+
+  const char *data = GetEntryData (f);
+  if (data && size)
+    *size = f->info.ucsize;
+  return data;
+}
+
+const char *csArchive::GetEntryData (ArchiveEntry *f) const
+{
+  // Validate the local header of the entry and return a pointer to its
+  // (possibly compressed) data inside the mapped image
+  size_t offs = f->info.relative_offset_local_header;
+  ZIP_local_file_header lfh;
+
+  if (!map_base
+      || (offs + sizeof (hdr_local) + ZIP_LOCAL_FILE_HEADER_SIZE > map_size)
+      || (memcmp (map_base + offs, hdr_local, sizeof (hdr_local)) != 0))
+    return NULL;
+
+  LoadLFH (lfh, map_base + offs + sizeof (hdr_local));
+  offs += sizeof (hdr_local) + ZIP_LOCAL_FILE_HEADER_SIZE +
+    lfh.filename_length + lfh.extra_field_length;
+  if ((offs > map_size) || (map_size - offs < f->info.csize))
+    return NULL;
+
+  return map_base + offs;
+}
+
+char *csArchive::ReadEntry (ArchiveEntry *f)
+{
+  // Same as ReadEntry (FILE *, ArchiveEntry *) but the input is taken
+  // straight from the mapped image without intermediate buffers
+  char *out_buff;
+  const char *in_buff = GetEntryData (f);
+
+  if (!in_buff)
+    return NULL;
+
+  out_buff = new char[f->info.ucsize + 1];
+  if (!out_buff)
+    return NULL;
+  out_buff [f->info.ucsize] = 0;
+
+  switch (f->info.compression_method)
+  {
+    case ZIP_STORE:
+      {
+        if (f->info.csize > f->info.ucsize)
+        {
+          delete [] out_buff;
+          return NULL;
+        } /* endif */
+        memcpy (out_buff, in_buff, f->info.csize);
+        break;
+      }
+    case ZIP_DEFLATE:
+      {
+        z_stream zs;
+
+        zs.next_in = (z_Byte *) in_buff;
+        zs.avail_in = f->info.csize;
+        zs.next_out = (z_Byte *) out_buff;
+        zs.avail_out = f->info.ucsize;
+        zs.zalloc = (alloc_func) 0;
+        zs.zfree = (free_func) 0;
+
+        /* Undocumented: if wbits is negative, zlib skips header check */
+        if (inflateInit2 (&zs, -DEF_WBITS) != Z_OK)
+        {
+          delete [] out_buff;
+          return NULL;
+        }
+        inflate (&zs, Z_FINISH);
+        inflateEnd (&zs);
+        break;
+      }
+    default:
+      {
+        /* Can't handle this compression algorythm */
+        delete [] out_buff;
+        return NULL;
+      }
+  } /* endswitch */
+  return out_buff;
+}
+
 char *csArchive::ReadEntry (FILE *infile, ArchiveEntry * f)
 {
   // This routine allocates one byte more than is actually needed
   // and fills it with zero. This can be used when reading text files
 
-  size_t bytes_left;
+  size_t bytes_left, in_offs;
   char buff[1024];
   char *out_buff;
   int err;
-  ZIP_local_file_header lfh;
 
   out_buff = new char[f->info.ucsize + 1];
   if (!out_buff)
     return NULL;
   out_buff [f->info.ucsize] = 0;
 
-  if ((fseek (infile, f->info.relative_offset_local_header, SEEK_SET))
-      || (fread (buff, 1, sizeof (hdr_local), infile) < sizeof (hdr_local))
-      || (memcmp (buff, hdr_local, sizeof (hdr_local)) != 0)
-      || (!ReadLFH (lfh, infile))
-      || (fseek (infile, lfh.filename_length + lfh.extra_field_length, SEEK_CUR)))
+  if (!(in_offs = GetDataOffset (infile, f)))
   {
     delete [] out_buff;
     return NULL;
@@ -306,7 +685,8 @@ char *csArchive::ReadEntry (FILE *infile, ArchiveEntry * f)
   {
     case ZIP_STORE:
       {
-        if (fread (out_buff, 1, f->info.csize, infile) < f->info.csize)
+        if ((f->info.csize > f->info.ucsize)
+         || !ReadAt (infile, in_offs, out_buff, f->info.csize))
         {
           delete [] out_buff;
           return NULL;
@@ -339,7 +719,8 @@ char *csArchive::ReadEntry (FILE *infile, ArchiveEntry * f)
             size = sizeof (buff);
           else
             size = bytes_left;
-          zs.avail_in = fread (buff, 1, size, infile);
+          zs.avail_in = ReadAt (infile, in_offs, buff, size) ? size : 0;
+          in_offs += size;
 
           err = inflate (&zs, bytes_left > size ? Z_PARTIAL_FLUSH : Z_FINISH);
           bytes_left -= size;
@@ -367,6 +748,131 @@ char *csArchive::ReadEntry (FILE *infile, ArchiveEntry * f)
   return out_buff;
 }
 
+void *csArchive::OpenStream (void *entry)
+{
+  ArchiveEntry *f = (ArchiveEntry *) entry;
+  ArchiveStream *st;
+
+  if (!f
+      || ((f->info.compression_method != ZIP_STORE)
+       && (f->info.compression_method != ZIP_DEFLATE)))
+    return NULL;
+
+  st = new ArchiveStream;
+  st->entry = f;
+  st->finished = false;
+  st->in_left = f->info.csize;
+  st->in_data = NULL;
+  st->in_offs = 0;
+
+  if (map_base)
+  {
+    if (!(st->in_data = GetEntryData (f)))
+    {
+      delete st;
+      return NULL;
+    }
+  }
+  else if (!(st->in_offs = GetDataOffset (file, f)))
+  {
+    delete st;
+    return NULL;
+  }
+
+  if (f->info.compression_method == ZIP_DEFLATE)
+  {
+    st->zs.zalloc = (alloc_func) 0;
+    st->zs.zfree = (free_func) 0;
+    st->zs.next_in = (z_Byte *) st->in_data;
+    st->zs.avail_in = 0;
+    if (inflateInit2 (&st->zs, -DEF_WBITS) != Z_OK)
+    {
+      delete st;
+      return NULL;
+    }
+  }
+  return (void *)st;
+}
+
+size_t csArchive::ReadStream (void *stream, char *data, size_t size)
+{
+  ArchiveStream *st = (ArchiveStream *) stream;
+
+  if (!st || st->finished)
+    return 0;
+
+  if (st->entry->info.compression_method == ZIP_STORE)
+  {
+    if (size > st->in_left)
+      size = st->in_left;
+    if (st->in_data)
+    {
+      memcpy (data, st->in_data, size);
+      st->in_data += size;
+    }
+    else if (!ReadAt (file, st->in_offs, data, size))
+    {
+      st->finished = true;
+      return 0;
+    }
+    st->in_offs += size;
+    st->in_left -= size;
+    return size;
+  }
+
+  st->zs.next_out = (z_Byte *) data;
+  st->zs.avail_out = size;
+  while (st->zs.avail_out)
+  {
+    if (!st->zs.avail_in && st->in_left)
+    {
+      size_t chunk;
+      if (st->in_data)
+      {
+        /* The mapped image is fed to zlib as a whole */
+        chunk = st->in_left;
+        st->zs.next_in = (z_Byte *) st->in_data;
+        st->in_data += chunk;
+      }
+      else
+      {
+        chunk = st->in_left > sizeof (st->buff) ? sizeof (st->buff) : st->in_left;
+        if (!ReadAt (file, st->in_offs, st->buff, chunk))
+        {
+          st->finished = true;
+          break;
+        }
+        st->zs.next_in = (z_Byte *) st->buff;
+      }
+      st->zs.avail_in = chunk;
+      st->in_offs += chunk;
+      st->in_left -= chunk;
+    }
+
+    int err = inflate (&st->zs, Z_SYNC_FLUSH);
+    if ((err == Z_STREAM_END)
+     || ((err != Z_OK) && (err != Z_BUF_ERROR))
+     || ((err == Z_BUF_ERROR) && !st->in_left && !st->zs.avail_in))
+    {
+      st->finished = true;
+      break;
+    }
+  } /* endwhile */
+
+  return size - st->zs.avail_out;
+}
+
+void csArchive::CloseStream (void *stream)
+{
+  ArchiveStream *st = (ArchiveStream *) stream;
+
+  if (!st)
+    return;
+  if (st->entry->info.compression_method == ZIP_DEFLATE)
+    inflateEnd (&st->zs);
+  delete st;
+}
+
 void *csArchive::NewFile (const char *name, size_t size, bool pack)
 {
   DeleteFile (name);
@@ -576,6 +1082,7 @@ skip_entry:
     size_t fsize = ftell (temp);
 
     fseek (temp, 0, SEEK_SET);
+    UnmapArchive ();
     fclose (file);
 
     if ((file = fopen (filename, "wb")) == NULL)
@@ -593,6 +1100,8 @@ skip_entry:
         fclose (temp);
         fclose (file);
         file = fopen (filename, "rb");
+        if (mode == omMapped)
+          MapArchive ();
         return false;
       }
       fsize -= bytes_read;
@@ -608,6 +1117,8 @@ skip_entry:
   success = true;
 
 temp_failed:
+  if (mode == omMapped)
+    MapArchive ();
   fclose (temp);
   unlink (temp_file);
   return success;
@@ -670,6 +1181,7 @@ void csArchive::UpdateDirectory ()
     lazy [n] = NULL;
   }
   lazy.DeleteAll ();
+  BuildHash ();
 }
 
 bool csArchive::IsDeleted (const char *name) const
@@ -718,6 +1230,12 @@ bool csArchive::ReadCDFH (ZIP_central_directory_file_header & cdfh, FILE *infile
   if (fread (buff, 1, ZIP_CENTRAL_DIRECTORY_FILE_HEADER_SIZE, infile) < ZIP_CENTRAL_DIRECTORY_FILE_HEADER_SIZE)
     return false;
 
+  LoadCDFH (cdfh, buff);
+  return true;
+}
+
+void csArchive::LoadCDFH (ZIP_central_directory_file_header & cdfh, char *buff) const
+{
   cdfh.version_made_by[0] = buff[C_VERSION_MADE_BY_0];
   cdfh.version_made_by[1] = buff[C_VERSION_MADE_BY_1];
   cdfh.version_needed_to_extract[0] = buff[C_VERSION_NEEDED_TO_EXTRACT_0];
@@ -736,8 +1254,6 @@ bool csArchive::ReadCDFH (ZIP_central_directory_file_header & cdfh, FILE *infile
   cdfh.internal_file_attributes = BUFF_GET_SHORT (C_INTERNAL_FILE_ATTRIBUTES);
   cdfh.external_file_attributes = BUFF_GET_LONG (C_EXTERNAL_FILE_ATTRIBUTES);
   cdfh.relative_offset_local_header = BUFF_GET_LONG (C_RELATIVE_OFFSET_LOCAL_HEADER);
-
-  return true;
 }
 
 bool csArchive::ReadLFH (ZIP_local_file_header & lfh, FILE *infile)
@@ -747,6 +1263,12 @@ bool csArchive::ReadLFH (ZIP_local_file_header & lfh, FILE *infile)
   if (fread (buff, 1, ZIP_LOCAL_FILE_HEADER_SIZE, infile) < ZIP_LOCAL_FILE_HEADER_SIZE)
     return false;
 
+  LoadLFH (lfh, buff);
+  return true;
+}
+
+void csArchive::LoadLFH (ZIP_local_file_header & lfh, char *buff) const
+{
   lfh.version_needed_to_extract[0] = buff[L_VERSION_NEEDED_TO_EXTRACT_0];
   lfh.version_needed_to_extract[1] = buff[L_VERSION_NEEDED_TO_EXTRACT_1];
   lfh.general_purpose_bit_flag = BUFF_GET_SHORT (L_GENERAL_PURPOSE_BIT_FLAG);
@@ -758,8 +1280,6 @@ bool csArchive::ReadLFH (ZIP_local_file_header & lfh, FILE *infile)
   lfh.ucsize = BUFF_GET_LONG (L_UNCOMPRESSED_SIZE);
   lfh.filename_length = BUFF_GET_SHORT (L_FILENAME_LENGTH);
   lfh.extra_field_length = BUFF_GET_SHORT (L_EXTRA_FIELD_LENGTH);
-
-  return true;
 }
 
 bool csArchive::WriteECDR (ZIP_end_central_dir_record & ecdr, FILE *outfile)
@@ -937,6 +1457,40 @@ bool csArchive::ArchiveEntry::ReadFileComment (FILE *infile, size_t file_comment
   else return true;
 }
 
+bool csArchive::ArchiveEntry::ReadExtraField (const char *src, size_t extra_field_length)
+{
+  if (extrafield && (info.extra_field_length != extra_field_length))
+  {
+    delete [] extrafield;
+    extrafield = NULL;
+  }
+  info.extra_field_length = extra_field_length;
+  if (extra_field_length)
+  {
+    if (!extrafield)
+      extrafield = new char[extra_field_length];
+    memcpy (extrafield, src, extra_field_length);
+  }
+  return true;
+}
+
+bool csArchive::ArchiveEntry::ReadFileComment (const char *src, size_t file_comment_length)
+{
+  if (comment && (info.file_comment_length != file_comment_length))
+  {
+    delete [] comment;
+    comment = NULL;
+  }
+  info.file_comment_length = file_comment_length;
+  if (file_comment_length)
+  {
+    if (!comment)
+      comment = new char[file_comment_length];
+    memcpy (comment, src, file_comment_length);
+  }
+  return true;
+}
+
 bool csArchive::ArchiveEntry::WriteFile (FILE *outfile)
 {
   size_t lfhoffs = ftell (outfile);
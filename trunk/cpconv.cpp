@@ -0,0 +1,207 @@
+#include <ctype.h>
+#include <errno.h>
+#include <iconv.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "cpconv.h"
+
+// Unicode of chars 0x80-0xFF, 0 - undefined char
+static const unsigned short cp1251_ucs[128] = {
+  0x0402, 0x0403, 0x201A, 0x0453, 0x201E, 0x2026, 0x2020, 0x2021,
+  0x20AC, 0x2030, 0x0409, 0x2039, 0x040A, 0x040C, 0x040B, 0x040F,
+  0x0452, 0x2018, 0x2019, 0x201C, 0x201D, 0x2022, 0x2013, 0x2014,
+  0x0000, 0x2122, 0x0459, 0x203A, 0x045A, 0x045C, 0x045B, 0x045F,
+  0x00A0, 0x040E, 0x045E, 0x0408, 0x00A4, 0x0490, 0x00A6, 0x00A7,
+  0x0401, 0x00A9, 0x0404, 0x00AB, 0x00AC, 0x00AD, 0x00AE, 0x0407,
+  0x00B0, 0x00B1, 0x0406, 0x0456, 0x0491, 0x00B5, 0x00B6, 0x00B7,
+  0x0451, 0x2116, 0x0454, 0x00BB, 0x0458, 0x0405, 0x0455, 0x0457,
+  0x0410, 0x0411, 0x0412, 0x0413, 0x0414, 0x0415, 0x0416, 0x0417,
+  0x0418, 0x0419, 0x041A, 0x041B, 0x041C, 0x041D, 0x041E, 0x041F,
+  0x0420, 0x0421, 0x0422, 0x0423, 0x0424, 0x0425, 0x0426, 0x0427,
+  0x0428, 0x0429, 0x042A, 0x042B, 0x042C, 0x042D, 0x042E, 0x042F,
+  0x0430, 0x0431, 0x0432, 0x0433, 0x0434, 0x0435, 0x0436, 0x0437,
+  0x0438, 0x0439, 0x043A, 0x043B, 0x043C, 0x043D, 0x043E, 0x043F,
+  0x0440, 0x0441, 0x0442, 0x0443, 0x0444, 0x0445, 0x0446, 0x0447,
+  0x0448, 0x0449, 0x044A, 0x044B, 0x044C, 0x044D, 0x044E, 0x044F,
+};
+
+static const unsigned short cp866_ucs[128] = {
+  0x0410, 0x0411, 0x0412, 0x0413, 0x0414, 0x0415, 0x0416, 0x0417,
+  0x0418, 0x0419, 0x041A, 0x041B, 0x041C, 0x041D, 0x041E, 0x041F,
+  0x0420, 0x0421, 0x0422, 0x0423, 0x0424, 0x0425, 0x0426, 0x0427,
+  0x0428, 0x0429, 0x042A, 0x042B, 0x042C, 0x042D, 0x042E, 0x042F,
+  0x0430, 0x0431, 0x0432, 0x0433, 0x0434, 0x0435, 0x0436, 0x0437,
+  0x0438, 0x0439, 0x043A, 0x043B, 0x043C, 0x043D, 0x043E, 0x043F,
+  0x2591, 0x2592, 0x2593, 0x2502, 0x2524, 0x2561, 0x2562, 0x2556,
+  0x2555, 0x2563, 0x2551, 0x2557, 0x255D, 0x255C, 0x255B, 0x2510,
+  0x2514, 0x2534, 0x252C, 0x251C, 0x2500, 0x253C, 0x255E, 0x255F,
+  0x255A, 0x2554, 0x2569, 0x2566, 0x2560, 0x2550, 0x256C, 0x2567,
+  0x2568, 0x2564, 0x2565, 0x2559, 0x2558, 0x2552, 0x2553, 0x256B,
+  0x256A, 0x2518, 0x250C, 0x2588, 0x2584, 0x258C, 0x2590, 0x2580,
+  0x0440, 0x0441, 0x0442, 0x0443, 0x0444, 0x0445, 0x0446, 0x0447,
+  0x0448, 0x0449, 0x044A, 0x044B, 0x044C, 0x044D, 0x044E, 0x044F,
+  0x0401, 0x0451, 0x0404, 0x0454, 0x0407, 0x0457, 0x040E, 0x045E,
+  0x00B0, 0x2219, 0x00B7, 0x221A, 0x2116, 0x00A4, 0x25A0, 0x00A0,
+};
+
+struct cp_cnv_s {
+  iconv_t ic;                 // (iconv_t)-1 if table is used
+  unsigned char utf8[128][4]; // UTF-8 of chars 0x80-0xFF, [3] - length
+};
+
+// Compare charset names ignoring case, '-' and '_'
+static int CodeNameIs(const char *code, const char *name)
+{
+  for (;; code++)
+  {
+    if (*code == '-' || *code == '_') continue;
+    if (*name == 0) return *code == 0;
+    if (toupper((unsigned char)*code) != *name) return 0;
+    name++;
+  }
+}
+
+static const unsigned short *CodeTable(const char *code)
+{
+  if (CodeNameIs(code, "CP1251") || CodeNameIs(code, "WINDOWS1251"))
+    return cp1251_ucs;
+  if (CodeNameIs(code, "CP866") || CodeNameIs(code, "IBM866"))
+    return cp866_ucs;
+  return NULL;
+}
+
+extern "C" cp_cnv_t cp_cnv_open(const char *tocode, const char *fromcode)
+{
+  const unsigned short *ucs = NULL;
+  cp_cnv_t cnv;
+  int i;
+
+  if (CodeNameIs(tocode, "UTF8"))
+    ucs = CodeTable(fromcode);
+
+  if ((cnv = (cp_cnv_t)malloc(sizeof(struct cp_cnv_s))) == NULL)
+    return (cp_cnv_t)-1;
+
+  cnv->ic = (iconv_t)-1;
+  if (ucs == NULL)
+  {
+    if ((cnv->ic = iconv_open(tocode, fromcode)) == (iconv_t)-1)
+    {
+      free(cnv);
+      return (cp_cnv_t)-1;
+    }
+    return cnv;
+  }
+
+  for (i = 0; i < 128; i++)
+  {
+    unsigned int u = ucs[i];
+    unsigned char *d = cnv->utf8[i];
+    if (u == 0)
+      d[3] = 0;
+    else if (u < 0x800)
+    {
+      d[0] = 0xC0 | (u >> 6);
+      d[1] = 0x80 | (u & 0x3F);
+      d[3] = 2;
+    }
+    else
+    {
+      d[0] = 0xE0 | (u >> 12);
+      d[1] = 0x80 | ((u >> 6) & 0x3F);
+      d[2] = 0x80 | (u & 0x3F);
+      d[3] = 3;
+    }
+  }
+  return cnv;
+}
+
+// Convert like iconv: returns 0 or (size_t)-1 with errno set to EILSEQ
+// (undefined char) or E2BIG (output buffer is full)
+extern "C" size_t cp_cnv(cp_cnv_t cnv, char **inbuf, size_t *inleft,
+                         char **outbuf, size_t *outleft)
+{
+  const unsigned char *in, *in_end;
+  unsigned char *out, *out_end;
+  size_t ret = 0;
+
+  if (cnv->ic != (iconv_t)-1)
+    return iconv(cnv->ic, inbuf, inleft, outbuf, outleft);
+  // stateless, nothing to reset or flush
+  if (inbuf == NULL || *inbuf == NULL)
+    return 0;
+
+  in = (const unsigned char *)*inbuf;
+  in_end = in + *inleft;
+  out = (unsigned char *)*outbuf;
+  out_end = out + *outleft;
+
+  while (in < in_end)
+  {
+#ifdef __SSE2__
+    // copy runs of ASCII chars by 16 bytes
+    while (in_end - in >= 16 && out_end - out >= 16)
+    {
+      __m128i v = _mm_loadu_si128((const __m128i *)in);
+      if (_mm_movemask_epi8(v) != 0) break;
+      _mm_storeu_si128((__m128i *)out, v);
+      in += 16;
+      out += 16;
+    }
+    if (in == in_end) break;
+#endif
+    if (*in < 0x80)
+    {
+      if (out == out_end) { errno = E2BIG; ret = (size_t)-1; break; }
+      *out++ = *in++;
+    }
+    else
+    {
+      const unsigned char *d = cnv->utf8[*in - 0x80];
+      if (d[3] == 0) { errno = EILSEQ; ret = (size_t)-1; break; }
+      if (out_end - out < d[3]) { errno = E2BIG; ret = (size_t)-1; break; }
+      memcpy(out, d, d[3]);
+      out += d[3];
+      in++;
+    }
+  }
+
+  *inleft -= (char *)in - *inbuf;
+  *inbuf = (char *)in;
+  *outleft -= (char *)out - *outbuf;
+  *outbuf = (char *)out;
+  return ret;
+}
+
+extern "C" void cp_cnv_close(cp_cnv_t cnv)
+{
+  if (cnv != (cp_cnv_t)-1)
+  {
+    if (cnv->ic != (iconv_t)-1) iconv_close(cnv->ic);
+    free(cnv);
+  }
+}
+
+// Same as strnewcnv, but with cp_cnv converter
+extern "C" char *cp_strnew(cp_cnv_t cnv, const char *str)
+{
+  size_t in_len = strlen(str) + 1, out_len = in_len * 4;
+  char *tmp = (char *)malloc(out_len);
+  if (tmp != NULL)
+  {
+    char *c_str = (char *)str, *o_str = tmp;
+
+    cp_cnv(cnv, NULL, NULL, NULL, NULL);
+    if (cp_cnv(cnv, &c_str, &in_len, &o_str, &out_len) != (size_t)(-1))
+      tmp = (char *)realloc(tmp, o_str - tmp);
+    else
+    {
+      free(tmp);
+      tmp = NULL;
+    }
+  }
+  return tmp;
+}
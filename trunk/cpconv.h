@@ -0,0 +1,25 @@
+#ifndef __CPCONV_H__
+#define __CPCONV_H__
+
+#include <stddef.h>
+
+// Charset converter with the same interface as iconv. Known single-byte
+// codepages (CP1251, CP866) to UTF-8 are converted by built-in tables,
+// any other pair is passed to iconv.
+typedef struct cp_cnv_s *cp_cnv_t;
+
+#ifdef __cplusplus
+extern "C" cp_cnv_t cp_cnv_open(const char *tocode, const char *fromcode);
+extern "C" size_t cp_cnv(cp_cnv_t cnv, char **inbuf, size_t *inleft,
+                         char **outbuf, size_t *outleft);
+extern "C" void cp_cnv_close(cp_cnv_t cnv);
+extern "C" char *cp_strnew(cp_cnv_t cnv, const char *str);
+#else
+extern cp_cnv_t cp_cnv_open(const char *tocode, const char *fromcode);
+extern size_t cp_cnv(cp_cnv_t cnv, char **inbuf, size_t *inleft,
+                     char **outbuf, size_t *outleft);
+extern void cp_cnv_close(cp_cnv_t cnv);
+extern char *cp_strnew(cp_cnv_t cnv, const char *str);
+#endif
+
+#endif // __CPCONV_H__
@@ -68,6 +68,20 @@ struct csFileTime
  * <li>Several methods of the csArchive class requires approximatively 20K of
  *     stack space when invoked.
  * </ul>
+ * <p>
+ * When opened with omMapped mode the archive file is mapped into memory
+ * and the directory scan, local header checks and decompression all work
+ * directly over the mapped image instead of going through stdio. If the
+ * file cannot be mapped the archive silently falls back to omStdio.
+ * <p>
+ * Concurrency: reading methods (FileExists(), FindName(), Read(),
+ * GetView() and ReadStream() on different streams) do not change shared
+ * state, so any number of threads may read from one open archive at
+ * once. The file is read from the mapped image or with positional reads
+ * (pread, OS_LINUX); elsewhere seek and read of the shared FILE are done
+ * under the stream lock, so reads are safe but serialized. Methods
+ * changing the archive (NewFile(), DeleteFile(), Write(), SetFileTime(),
+ * Flush()) must not run concurrently with any other call.
  */
 class csArchive
 {
@@ -77,6 +91,15 @@ public:
   static char hdr_endcentral[4];
   static char hdr_extlocal[4];
 
+  /// Archive access method
+  enum OpenMode
+  {
+    /// Read the archive through stdio calls
+    omStdio,
+    /// Map the archive into memory and read directly from the image
+    omMapped
+  };
+
 private:
   /// csArchive entry class
   class ArchiveEntry
@@ -96,11 +119,26 @@ private:
     bool WriteCDFH (FILE *file);
     bool ReadExtraField (FILE *file, size_t extra_field_length);
     bool ReadFileComment (FILE *file, size_t file_comment_length);
+    bool ReadExtraField (const char *src, size_t extra_field_length);
+    bool ReadFileComment (const char *src, size_t file_comment_length);
     bool WriteFile (FILE *file);
     void FreeBuffer ();
   };
   friend class ArchiveEntry;
 
+  /// Sequential reader state, see OpenStream ()
+  class ArchiveStream
+  {
+  public:
+    ArchiveEntry *entry;
+    z_stream zs;
+    bool finished;		// Set when no more data can be returned
+    const char *in_data;	// Next input byte in mapped image (or NULL)
+    size_t in_offs;		// Offset of next input byte in archive file
+    size_t in_left;		// Compressed bytes not consumed yet
+    char buff[1024];		// Input buffer when reading through stdio
+  };
+
   /// A vector of ArchiveEntries
   class ArchiveEntryVector : public csVector
   {
@@ -123,16 +161,27 @@ private:
 
   char *filename;		// Archive file name
   FILE *file;			// Archive file pointer.
+  OpenMode mode;		// Requested access method
+  char *map_base;		// Mapped archive image (omMapped) or NULL
+  size_t map_size;		// Size of the mapped image
+  ArchiveEntry **hash;		// Hash index of dir by file name (or NULL)
+  int hash_size;		// Number of hash slots (power of 2)
+  bool dir_found;		// Central directory was read (not rebuilt)
 
   size_t comment_length;	// Archive comment length
   char *comment;		// Archive comment
 
   void ReadDirectory ();
+  void BuildHash ();
+  static unsigned int HashName (const char *name);
   bool IsDeleted (const char *name) const;
   void UnpackTime (ush zdate, ush ztime, csFileTime &rtime) const;
   void PackTime (const csFileTime &ztime, ush &rdate, ush &rtime) const;
   bool ReadArchiveComment (FILE *file, size_t zipfile_comment_length);
+  bool ReadArchiveComment (const char *src, size_t zipfile_comment_length);
   void LoadECDR (ZIP_end_central_dir_record &ecdr, char *buff);
+  void LoadCDFH (ZIP_central_directory_file_header &cdfh, char *buff) const;
+  void LoadLFH (ZIP_local_file_header &lfh, char *buff) const;
   bool ReadCDFH (ZIP_central_directory_file_header &cdfh, FILE *file);
   bool ReadLFH (ZIP_local_file_header &lfh, FILE *file);
   bool WriteECDR (ZIP_end_central_dir_record &ecdr, FILE *file);
@@ -143,10 +192,18 @@ private:
   ArchiveEntry *InsertEntry (const char *name, ZIP_central_directory_file_header &cdfh);
   void ReadZipEntries (FILE *infile);
   char *ReadEntry (FILE *infile, ArchiveEntry *f);
+  bool ReadAt (FILE *infile, size_t offs, void *data, size_t size) const;
+  size_t GetDataOffset (FILE *infile, ArchiveEntry *f) const;
+  bool MapArchive ();
+  void UnmapArchive ();
+  void ReadZipDirectory (const char *image, size_t size);
+  void ReadZipEntries (const char *image, size_t size);
+  const char *GetEntryData (ArchiveEntry *f) const;
+  char *ReadEntry (ArchiveEntry *f);
 
 public:
   /// Open the archive.
-  csArchive (const char *filename);
+  csArchive (const char *filename, OpenMode mode = omStdio);
   /// Close the archive.
   ~csArchive ();
 
@@ -189,6 +246,30 @@ public:
    * to unpacked size of the file.
    */
   char *Read (const char *name, size_t *size = NULL);
+  /// Same as above, but for a handle returned by FindName() or GetFile()
+  char *Read (void *entry, size_t *size = NULL);
+
+  /**
+   * Return a read-only view of a file stored without compression.
+   * The pointer addresses the file data right inside the mapped archive
+   * image, so nothing is allocated or copied; it stays valid until the
+   * archive is flushed or destroyed. Note that unlike Read() the data is
+   * not zero-terminated. Returns NULL if the archive is not mapped or the
+   * file is compressed - use Read() in this case.
+   */
+  const char *GetView (void *entry, size_t *size = NULL) const;
+
+  /**
+   * Open a sequential reader for a file. Data is unpacked in small
+   * portions on every ReadStream() call so the whole file is never held
+   * in memory at once. Returns NULL on failure; a successfully opened
+   * stream should be released with CloseStream().
+   */
+  void *OpenStream (void *entry);
+  /// Read up to 'size' next bytes from stream; returns number of bytes read
+  size_t ReadStream (void *stream, char *data, size_t size);
+  /// Close a stream opened with OpenStream()
+  void CloseStream (void *stream);
 
   /**
    * Write data to a file. Note that 'size' need not be
@@ -213,7 +294,11 @@ public:
   void *GetFile (int no)
   { return (no >= 0) && (no < dir.Length ()) ? dir.Get (no) : NULL; }
 
-  /// Find a file in archive; returns a handle or NULL
+  /**
+   * Find a file in archive; returns a handle or NULL. Names are looked up
+   * in a hash index built when the directory is read, so pass the handle
+   * on to Read(), GetView() etc. instead of searching by name again.
+   */
   void *FindName (const char *name) const;
   /// Query name from handle
   char *GetFileName (void *entry) const
@@ -221,11 +306,25 @@ public:
   /// Query file size from handle
   size_t GetFileSize (void *entry) const
   { return ((ArchiveEntry*)entry)->info.ucsize; }
+  /// Query CRC-32 of file data from handle
+  unsigned long GetFileCRC (void *entry) const
+  { return ((ArchiveEntry*)entry)->info.crc32; }
   /// Query filetime from handle
   void GetFileTime (void *entry, csFileTime &ztime) const;
   /// Set filetime for handle
   void SetFileTime (void *entry, const csFileTime &ztime);
 
+  /// Query whether the archive is read from a memory-mapped image
+  bool IsMapped () const
+  { return map_base != NULL; }
+  /**
+   * Query whether the directory was read from the central directory.
+   * False if it was rebuilt from local headers (e.g. the file is
+   * truncated) and may miss files.
+   */
+  bool HasCentralDirectory () const
+  { return dir_found; }
+
   /// Query archive filename
   char *GetName () const
   { return filename; }
@@ -15,7 +15,7 @@ typedef struct {
 } PACKED NDX_RECORD;
 
 typedef struct {
-  unsigned long rec_count;
+  unsigned int rec_count; // 32 bit on both ILP32 and LP64 hosts
 } PACKED NDX_HEADER;
 
 typedef struct {
@@ -0,0 +1,447 @@
+#include <iconv.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "libjtv.h"
+
+#define AIRING_BUCKET_SEC 3600 // default width of time bucket
+#define AIRING_MAX_BUCKETS 0x10000 // bucket is widened to keep this limit
+#define AIRING_LONG_SPAN 16 // programs spanning more buckets are kept apart
+
+// Programs by time buckets. Bucket b holds (in list order) programs going
+// at any moment of [base + b * width, base + (b + 1) * width), programs
+// longer than AIRING_LONG_SPAN buckets are checked by every query.
+// Index and its arrays are one block freed by FreeJTV
+struct jtv_airing_index {
+  unsigned int num; // number of programs of list when index was built
+  time_t base;
+  time_t width;
+  unsigned int buckets;
+  unsigned int long_num;
+  unsigned int *start; // first item of bucket, buckets + 1 items
+  unsigned int *items;
+  unsigned int *longs;
+};
+
+// Offset of time from base saturated to int range
+static int TimeOffset(time_t t, time_t base)
+{
+  if (t - base > INT_MAX) return INT_MAX;
+  if (t - base < INT_MIN) return INT_MIN;
+  return (int)(t - base);
+}
+
+// Build columns of programs of list (again, if list was changed).
+// All columns are kept in one block freed by FreeJTV. Returns 0 on error
+int BuildJTVColumns(tv_list *tvl)
+{
+  tv_columns *cols;
+  unsigned int i, num = tvl->num;
+  time_t base = num ? tvl->tvp[0].time : 0;
+
+  if ((cols = (tv_columns *)realloc(tvl->cols, sizeof(tv_columns) +
+                                    num * 4 * sizeof(int))) == NULL)
+    return 0;
+  tvl->cols = cols;
+
+  for (i = 1; i < num; i++)
+    if (tvl->tvp[i].time < base) base = tvl->tvp[i].time;
+
+  cols->num = num;
+  cols->base = base;
+  cols->time = (int *)(cols + 1);
+  cols->etime = cols->time + num;
+  cols->ch_index = cols->etime + num;
+  cols->title_id = (unsigned int *)(cols->ch_index + num);
+  for (i = 0; i < num; i++)
+  {
+    cols->time[i] = TimeOffset(tvl->tvp[i].time, base);
+    cols->etime[i] = TimeOffset(tvl->tvp[i].etime, base);
+    cols->ch_index[i] = tvl->tvp[i].ch_index;
+    cols->title_id[i] = tvl->tvp[i].title_id;
+  }
+  return 1;
+}
+
+// Find programs going at any moment of [from, to] (both inclusive, as
+// etime of program). Up to max program indexes are stored into idx in list
+// order, returns number of all found programs. Columns must be built by
+// BuildJTVColumns after the list was loaded or changed, otherwise
+// JTV_NOT_INDEXED is returned: queries don't change the list and may run
+// in parallel
+unsigned int JTVProgramsBetween(tv_list *tvl, time_t from, time_t to,
+                                unsigned int *idx, unsigned int max)
+{
+  tv_columns *cols = tvl->cols;
+  unsigned int i = 0, found = 0;
+  int t_from, t_to;
+
+  if (cols == NULL || cols->num != tvl->num)
+    return JTV_NOT_INDEXED;
+  t_from = TimeOffset(from, cols->base);
+  t_to = TimeOffset(to, cols->base);
+
+#ifdef __SSE2__
+  {
+    __m128i v_from = _mm_set1_epi32(t_from), v_to = _mm_set1_epi32(t_to);
+
+    // check 4 programs at once: !(time > to) && !(from > etime)
+    for (; i + 4 <= cols->num; i += 4)
+    {
+      __m128i t = _mm_loadu_si128((const __m128i *)(cols->time + i));
+      __m128i e = _mm_loadu_si128((const __m128i *)(cols->etime + i));
+      __m128i out = _mm_or_si128(_mm_cmpgt_epi32(t, v_to),
+                                 _mm_cmpgt_epi32(v_from, e));
+      int mask = ~_mm_movemask_ps(_mm_castsi128_ps(out)) & 0xF;
+
+      while (mask)
+      {
+        int n = __builtin_ctz(mask);
+        if (found < max) idx[found] = i + n;
+        found++;
+        mask &= mask - 1;
+      }
+    }
+  }
+#endif
+  for (; i < cols->num; i++)
+    if (cols->time[i] <= t_to && cols->etime[i] >= t_from)
+    {
+      if (found < max) idx[found] = i;
+      found++;
+    }
+  return found;
+}
+
+// Stable LSD radix sort of n keys by bytes, sorted key numbers are
+// stored into out. Bytes equal for all keys are skipped. Returns 0 on error
+static int RadixSort(const unsigned long long *key, unsigned int n,
+                     unsigned int *out)
+{
+  unsigned int (*count)[256] =
+    (unsigned int (*)[256])calloc(8 * 256, sizeof(unsigned int));
+  unsigned int *tmp = (unsigned int *)malloc(n * sizeof(unsigned int));
+  unsigned int *src = out, *dst = tmp;
+  unsigned int i;
+  int b;
+
+  if (count == NULL || tmp == NULL)
+  {
+    free(count);
+    free(tmp);
+    return 0;
+  }
+
+  // histograms of all bytes in one pass
+  for (i = 0; i < n; i++)
+  {
+    unsigned long long k = key[i];
+    for (b = 0; b < 8; b++, k >>= 8)
+      count[b][k & 0xFF]++;
+    out[i] = i;
+  }
+
+  for (b = 0; b < 8; b++)
+  {
+    unsigned int sum = 0, c, *t;
+
+    if (count[b][(key[0] >> (b * 8)) & 0xFF] == n)
+      continue;
+    for (c = 0; c < 256; c++)
+    {
+      unsigned int cnt = count[b][c];
+      count[b][c] = sum;
+      sum += cnt;
+    }
+    for (i = 0; i < n; i++)
+      dst[count[b][(key[src[i]] >> (b * 8)) & 0xFF]++] = src[i];
+    t = src;
+    src = dst;
+    dst = t;
+  }
+
+  if (src != out)
+    memcpy(out, src, n * sizeof(unsigned int));
+  free(count);
+  free(tmp);
+  return 1;
+}
+
+// Fill index_time and index_etime of programs of list by stable radix
+// sort of their times (programs with equal times keep list order).
+// Returns 0 on error
+int BuildJTVIndex(tv_list *tvl)
+{
+  unsigned int i, n = tvl->num;
+  unsigned long long *key;
+  unsigned int *order;
+  time_t base;
+
+  if (n == 0)
+  {
+    tvl->index_num = 0;
+    return 1;
+  }
+  key = (unsigned long long *)malloc(n * sizeof(unsigned long long));
+  order = (unsigned int *)malloc(n * sizeof(unsigned int));
+  if (key == NULL || order == NULL)
+  {
+    free(key);
+    free(order);
+    return 0;
+  }
+
+  // time_t is signed, sort distances from the least time
+  for (base = tvl->tvp[0].time, i = 1; i < n; i++)
+    if (tvl->tvp[i].time < base) base = tvl->tvp[i].time;
+  for (i = 0; i < n; i++)
+    key[i] = (unsigned long long)(tvl->tvp[i].time - base);
+  if (!RadixSort(key, n, order))
+    goto fail;
+  for (i = 0; i < n; i++)
+    tvl->tvp[i].index_time = order[i];
+
+  for (base = tvl->tvp[0].etime, i = 1; i < n; i++)
+    if (tvl->tvp[i].etime < base) base = tvl->tvp[i].etime;
+  for (i = 0; i < n; i++)
+    key[i] = (unsigned long long)(tvl->tvp[i].etime - base);
+  if (!RadixSort(key, n, order))
+    goto fail;
+  for (i = 0; i < n; i++)
+    tvl->tvp[i].index_etime = order[i];
+
+  free(key);
+  free(order);
+  tvl->index_num = n;
+  return 1;
+
+fail:
+  free(key);
+  free(order);
+  tvl->index_num = 0;
+  return 0;
+}
+
+// Position in index_time order of the first program starting after t,
+// tvl->num if there is no such program. JTV_NOT_INDEXED if the list isn't
+// indexed by BuildJTVIndex (after it was loaded or changed): queries don't
+// change the list and may run in parallel
+unsigned int JTVFirstStartAfter(tv_list *tvl, time_t t)
+{
+  unsigned int lo = 0, hi = tvl->num;
+
+  if (tvl->index_num != tvl->num)
+    return JTV_NOT_INDEXED;
+  while (lo < hi)
+  {
+    unsigned int mid = lo + (hi - lo) / 2;
+    if (tvl->tvp[tvl->tvp[mid].index_time].time > t)
+      hi = mid;
+    else
+      lo = mid + 1;
+  }
+  return lo;
+}
+
+// Position in index_etime order of the first program ending after t
+// (i.e. going at t or later), tvl->num if there is no such program,
+// JTV_NOT_INDEXED if the list isn't indexed
+unsigned int JTVFirstEndAfter(tv_list *tvl, time_t t)
+{
+  unsigned int lo = 0, hi = tvl->num;
+
+  if (tvl->index_num != tvl->num)
+    return JTV_NOT_INDEXED;
+  while (lo < hi)
+  {
+    unsigned int mid = lo + (hi - lo) / 2;
+    if (tvl->tvp[tvl->tvp[mid].index_etime].etime >= t)
+      hi = mid;
+    else
+      lo = mid + 1;
+  }
+  return lo;
+}
+
+// Build time buckets index of list (again, if list was changed).
+// Returns 0 on error
+int BuildJTVAiringIndex(tv_list *tvl)
+{
+  jtv_airing_index *ai;
+  unsigned int *count, i, b, buckets = 0, items = 0, long_num = 0;
+  time_t base = 0, end = 0, width = AIRING_BUCKET_SEC;
+
+  // programs with broken etime are never airing
+  for (i = 0; i < tvl->num; i++)
+  {
+    tv_program *tvp = &tvl->tvp[i];
+    if (tvp->etime < tvp->time) continue;
+    if (buckets == 0 || tvp->time < base) base = tvp->time;
+    if (buckets == 0 || tvp->etime > end) end = tvp->etime;
+    buckets = 1;
+  }
+  if (buckets)
+  {
+    while ((end - base) / width >= AIRING_MAX_BUCKETS)
+      width *= 2;
+    buckets = (end - base) / width + 1;
+  }
+
+  if ((count = (unsigned int *)calloc(buckets + 1, sizeof(unsigned int))) ==
+      NULL)
+    return 0;
+  for (i = 0; i < tvl->num; i++)
+  {
+    tv_program *tvp = &tvl->tvp[i];
+    unsigned int b0, b1;
+    if (tvp->etime < tvp->time) continue;
+    b0 = (tvp->time - base) / width;
+    b1 = (tvp->etime - base) / width;
+    if (b1 - b0 >= AIRING_LONG_SPAN)
+      long_num++;
+    else
+    {
+      for (b = b0; b <= b1; b++)
+        count[b]++;
+      items += b1 - b0 + 1;
+    }
+  }
+
+  if ((ai = (jtv_airing_index *)realloc(tvl->airing, sizeof(jtv_airing_index) +
+         (buckets + 1 + items + long_num) * sizeof(unsigned int))) == NULL)
+  {
+    free(count);
+    return 0;
+  }
+  tvl->airing = ai;
+  ai->num = tvl->num;
+  ai->base = base;
+  ai->width = width;
+  ai->buckets = buckets;
+  ai->long_num = 0;
+  ai->start = (unsigned int *)(ai + 1);
+  ai->items = ai->start + buckets + 1;
+  ai->longs = ai->items + items;
+
+  // count becomes fill cursor of bucket
+  for (b = 0, items = 0; b < buckets; b++)
+  {
+    unsigned int cnt = count[b];
+    ai->start[b] = count[b] = items;
+    items += cnt;
+  }
+  ai->start[buckets] = items;
+
+  for (i = 0; i < tvl->num; i++)
+  {
+    tv_program *tvp = &tvl->tvp[i];
+    unsigned int b0, b1;
+    if (tvp->etime < tvp->time) continue;
+    b0 = (tvp->time - base) / width;
+    b1 = (tvp->etime - base) / width;
+    if (b1 - b0 >= AIRING_LONG_SPAN)
+      ai->longs[ai->long_num++] = i;
+    else
+      for (b = b0; b <= b1; b++)
+        ai->items[count[b]++] = i;
+  }
+  free(count);
+  return 1;
+}
+
+// Index built by BuildJTVAiringIndex for the current list, NULL if it
+// wasn't built or the list was changed since. Queries never build it, so
+// they don't change the list and may run in parallel
+static jtv_airing_index *AiringIndex(tv_list *tvl)
+{
+  if (tvl->airing == NULL || tvl->airing->num != tvl->num)
+    return NULL;
+  return tvl->airing;
+}
+
+// Find programs going at t. Up to max program indexes are stored into idx
+// in list order, returns number of all found programs (JTV_NOT_INDEXED if
+// the list isn't indexed by BuildJTVAiringIndex)
+unsigned int JTVAiringAt(tv_list *tvl, time_t t, unsigned int *idx,
+                         unsigned int max)
+{
+  jtv_airing_index *ai = AiringIndex(tvl);
+  unsigned int i, l = 0, i_end, found = 0;
+
+  if (ai == NULL)
+    return JTV_NOT_INDEXED;
+  if (ai->buckets == 0 || t < ai->base ||
+      (t - ai->base) / ai->width >= ai->buckets)
+    return 0;
+  i = ai->start[(t - ai->base) / ai->width];
+  i_end = ai->start[(t - ai->base) / ai->width + 1];
+
+  // merge bucket and long programs, both are in list order
+  while (i < i_end || l < ai->long_num)
+  {
+    unsigned int n;
+    if (l == ai->long_num || (i < i_end && ai->items[i] < ai->longs[l]))
+      n = ai->items[i++];
+    else
+      n = ai->longs[l++];
+    if (tvl->tvp[n].time <= t && tvl->tvp[n].etime >= t)
+    {
+      if (found < max) idx[found] = n;
+      found++;
+    }
+  }
+  return found;
+}
+
+// Call cb for every program going at any moment of [from, to] (both
+// inclusive). Programs are reported once, by buckets. Returns number of
+// reported programs (JTV_NOT_INDEXED if the list isn't indexed by
+// BuildJTVAiringIndex, cb isn't called then)
+unsigned int JTVAiringBetween(tv_list *tvl, time_t from, time_t to,
+                              jtv_airing_cb cb, void *data)
+{
+  jtv_airing_index *ai = AiringIndex(tvl);
+  unsigned int b, b0, b1, i, found = 0;
+
+  if (ai == NULL)
+    return JTV_NOT_INDEXED;
+  if (ai->buckets == 0 || to < from || to < ai->base)
+    return 0;
+  b0 = from < ai->base ? 0 : (from - ai->base) / ai->width;
+  if (b0 >= ai->buckets)
+    return 0;
+  if ((to - ai->base) / ai->width >= ai->buckets)
+    b1 = ai->buckets - 1;
+  else
+    b1 = (to - ai->base) / ai->width;
+
+  for (b = b0; b <= b1; b++)
+    for (i = ai->start[b]; i < ai->start[b + 1]; i++)
+    {
+      unsigned int n = ai->items[i];
+      tv_program *tvp = &tvl->tvp[n];
+      unsigned int first = tvp->time < ai->base + (time_t)b0 * ai->width ?
+        b0 : (tvp->time - ai->base) / ai->width;
+
+      // program spanning several buckets is reported in the first one
+      if (first == b && tvp->time <= to && tvp->etime >= from)
+      {
+        found++;
+        if (cb(tvl, n, data)) return found;
+      }
+    }
+
+  for (i = 0; i < ai->long_num; i++)
+  {
+    tv_program *tvp = &tvl->tvp[ai->longs[i]];
+    if (tvp->time <= to && tvp->etime >= from)
+    {
+      found++;
+      if (cb(tvl, ai->longs[i], data)) return found;
+    }
+  }
+  return found;
+}
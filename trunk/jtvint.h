@@ -0,0 +1,14 @@
+#ifndef __JTVINT_H__
+#define __JTVINT_H__
+
+// Internals shared by library sources, not a part of the API. Include
+// after libjtv.h
+
+// libjtv.cpp
+const char *JTVTitleSource(tv_list *tvl, unsigned int id, size_t *len);
+int BuildJTVChannelHash(tv_list *tvl);
+
+// jtvsnap.cpp
+void FreeJTVSnapshot(char *image, size_t size);
+
+#endif // __JTVINT_H__
@@ -0,0 +1,316 @@
+#include <iconv.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "libjtv.h"
+#include "jtvint.h"
+
+#if defined (OS_LINUX)
+#  define JTV_SNAP_MMAP
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#  include <fcntl.h>
+#  include <unistd.h>
+#endif
+
+#define JTV_SNAP_MAGIC "JTVSNAP"
+#define JTV_SNAP_VERSION 2
+// snapshot is bound to layout of structures it keeps
+#define JTV_SNAP_ABI (sizeof(tv_program) | sizeof(tv_channel) << 8 | \
+                      sizeof(void *) << 16 | sizeof(time_t) << 24)
+
+/*
+ Snapshot file: header, programs, title offsets, channels and strings.
+ Every part starts at 8 byte boundary. Pointers of programs, titles and
+ channels are stored as offsets into strings and relocated on loading,
+ so the file doesn't depend on address it is mapped at.
+ */
+typedef struct {
+  char magic[8];
+  unsigned int version;
+  unsigned int abi;
+  jtv_snap_key key;
+  unsigned int num;
+  unsigned int title_num;
+  unsigned int ch_num;
+  unsigned int index_num;
+  unsigned long long tvp_off;
+  unsigned long long titles_off;
+  unsigned long long channels_off;
+  unsigned long long strings_off;
+  unsigned long long size;
+} jtv_snap_header;
+
+static unsigned long long Align8(unsigned long long offs)
+{
+  return (offs + 7) & ~7ULL;
+}
+
+static int WritePad(FILE *out, unsigned long long offs)
+{
+  static const char zero[8] = {0};
+  size_t pad = Align8(offs) - offs;
+  return pad == 0 || fwrite(zero, 1, pad, out) == pad;
+}
+
+// Write list into snapshot file (through temporary file, so readers never
+// see partial snapshot). Returns 0 on error
+int SaveJTVSnapshot(tv_list *tvl, const char *fname, const jtv_snap_key *key)
+{
+  jtv_snap_header hdr;
+  char tmp_name[1024];
+  unsigned long long *title_offs, *ch_offs, str_size = 0;
+  tv_program buf[256];
+  unsigned int i, j, n = 0;
+  FILE *out;
+  int ok = 1;
+
+  // every program must belong to some channel
+  for (i = 0; i < tvl->ch_num; i++)
+  {
+    if (tvl->channels[i].first != n) return 0;
+    n += tvl->channels[i].num;
+  }
+  if (n != tvl->num) return 0;
+
+  if (strlen(fname) + 5 > sizeof(tmp_name)) return 0;
+  sprintf(tmp_name, "%s.tmp", fname);
+
+  title_offs = (unsigned long long *)
+    malloc((tvl->title_num + tvl->ch_num + 1) * sizeof(unsigned long long));
+  if (title_offs == NULL) return 0;
+  ch_offs = title_offs + tvl->title_num;
+
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, JTV_SNAP_MAGIC, sizeof(JTV_SNAP_MAGIC));
+  hdr.version = JTV_SNAP_VERSION;
+  hdr.abi = JTV_SNAP_ABI;
+  if (key) hdr.key = *key;
+  hdr.num = tvl->num;
+  hdr.title_num = tvl->title_num;
+  hdr.ch_num = tvl->ch_num;
+  hdr.index_num = tvl->index_num == tvl->num ? tvl->num : 0;
+
+  for (i = 0; i < tvl->title_num; i++)
+  {
+    size_t len;
+    JTVTitleSource(tvl, i, &len);
+    title_offs[i] = str_size;
+    str_size += len + 1;
+  }
+  for (i = 0; i < tvl->ch_num; i++)
+  {
+    ch_offs[i] = str_size;
+    str_size += strlen(tvl->channels[i].name) + 1;
+  }
+
+  hdr.tvp_off = Align8(sizeof(hdr));
+  hdr.titles_off = Align8(hdr.tvp_off +
+                          (unsigned long long)tvl->num * sizeof(tv_program));
+  hdr.channels_off = Align8(hdr.titles_off + (unsigned long long)
+                            tvl->title_num * sizeof(unsigned long long));
+  hdr.strings_off = Align8(hdr.channels_off +
+                           (unsigned long long)tvl->ch_num * sizeof(tv_channel));
+  hdr.size = hdr.strings_off + str_size;
+
+  if ((out = fopen(tmp_name, "wb")) == NULL)
+  {
+    free(title_offs);
+    return 0;
+  }
+
+  ok = fwrite(&hdr, sizeof(hdr), 1, out) == 1 && WritePad(out, sizeof(hdr));
+
+  // programs by chunks with pointers replaced by string offsets
+  for (i = 0; ok && i < tvl->ch_num; i++)
+  {
+    tv_channel *ch = &tvl->channels[i];
+    for (j = 0; ok && j < ch->num; j++)
+    {
+      buf[n = j % 256] = tvl->tvp[ch->first + j];
+      buf[n].ch_name = (char *)(size_t)ch_offs[i];
+      buf[n].prg_name = (char *)(size_t)title_offs[buf[n].title_id];
+      if (n == 255 || j + 1 == ch->num)
+        ok = fwrite(buf, sizeof(tv_program), n + 1, out) == n + 1;
+    }
+  }
+  ok = ok && WritePad(out, hdr.tvp_off +
+                      (unsigned long long)tvl->num * sizeof(tv_program));
+
+  ok = ok && fwrite(title_offs, sizeof(unsigned long long), tvl->title_num,
+                    out) == tvl->title_num;
+  ok = ok && WritePad(out, hdr.titles_off + (unsigned long long)
+                      tvl->title_num * sizeof(unsigned long long));
+
+  for (i = 0; ok && i < tvl->ch_num; i++)
+  {
+    tv_channel ch = tvl->channels[i];
+    ch.name = (char *)(size_t)ch_offs[i];
+    ok = fwrite(&ch, sizeof(ch), 1, out) == 1;
+  }
+  ok = ok && WritePad(out, hdr.channels_off +
+                      (unsigned long long)tvl->ch_num * sizeof(tv_channel));
+
+  for (i = 0; ok && i < tvl->title_num; i++)
+  {
+    size_t len;
+    const char *str = JTVTitleSource(tvl, i, &len);
+    ok = fwrite(str, 1, len, out) == len && fputc(0, out) != EOF;
+  }
+  for (i = 0; ok && i < tvl->ch_num; i++)
+  {
+    size_t len = strlen(tvl->channels[i].name) + 1;
+    ok = fwrite(tvl->channels[i].name, 1, len, out) == len;
+  }
+
+  free(title_offs);
+  if (fclose(out) != 0) ok = 0;
+  if (ok && rename(tmp_name, fname) != 0) ok = 0;
+  if (!ok) remove(tmp_name);
+  return ok;
+}
+
+// Read whole snapshot file into memory, returns its image or NULL
+static char *ReadSnapshot(const char *fname, size_t *size)
+{
+  char *image = NULL;
+#ifdef JTV_SNAP_MMAP
+  struct stat st;
+  int fd = open(fname, O_RDONLY);
+
+  if (fd < 0) return NULL;
+  if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(jtv_snap_header))
+  {
+    // private mapping: relocation writes don't go to the file
+    image = (char *)mmap(NULL, st.st_size, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE, fd, 0);
+    if (image == (char *)MAP_FAILED)
+      image = NULL;
+    else
+      *size = st.st_size;
+  }
+  close(fd);
+#else
+  FILE *in = fopen(fname, "rb");
+  long len;
+
+  if (in == NULL) return NULL;
+  if (fseek(in, 0, SEEK_END) == 0 && (len = ftell(in)) > 0 &&
+      (size_t)len >= sizeof(jtv_snap_header) && fseek(in, 0, SEEK_SET) == 0 &&
+      (image = (char *)malloc(len)) != NULL)
+  {
+    if (fread(image, 1, len, in) == (size_t)len)
+      *size = len;
+    else
+    {
+      free(image);
+      image = NULL;
+    }
+  }
+  fclose(in);
+#endif
+  return image;
+}
+
+void FreeJTVSnapshot(char *image, size_t size)
+{
+#ifdef JTV_SNAP_MMAP
+  munmap(image, size);
+#else
+  free(image);
+#endif
+}
+
+// Load list from snapshot made with the same key (any snapshot if key is
+// NULL). Programs, titles and channels stay in the snapshot image, which
+// is released by FreeJTV. Returns NULL if there is no valid snapshot
+tv_list *LoadJTVSnapshot(const char *fname, const jtv_snap_key *key)
+{
+  jtv_snap_header *hdr;
+  unsigned long long *offs, str_size;
+  tv_list *tvl;
+  char *image, *strings;
+  size_t size = 0;
+  unsigned int i;
+  int bad = 0;
+
+  if ((image = ReadSnapshot(fname, &size)) == NULL)
+    return NULL;
+  hdr = (jtv_snap_header *)image;
+
+  if (memcmp(hdr->magic, JTV_SNAP_MAGIC, sizeof(JTV_SNAP_MAGIC)) != 0 ||
+      hdr->version != JTV_SNAP_VERSION || hdr->abi != JTV_SNAP_ABI ||
+      (key && memcmp(&hdr->key, key, sizeof(*key)) != 0) ||
+      hdr->size != size || hdr->tvp_off < sizeof(*hdr) ||
+      hdr->titles_off < hdr->tvp_off +
+        (unsigned long long)hdr->num * sizeof(tv_program) ||
+      hdr->channels_off < hdr->titles_off +
+        (unsigned long long)hdr->title_num * sizeof(unsigned long long) ||
+      hdr->strings_off < hdr->channels_off +
+        (unsigned long long)hdr->ch_num * sizeof(tv_channel) ||
+      hdr->strings_off >= size || image[size - 1] != 0 ||
+      (hdr->index_num != 0 && hdr->index_num != hdr->num) ||
+      (tvl = (tv_list *)calloc(1, sizeof(tv_list))) == NULL)
+  {
+    FreeJTVSnapshot(image, size);
+    return NULL;
+  }
+
+  strings = image + hdr->strings_off;
+  str_size = size - hdr->strings_off;
+  tvl->snap = image;
+  tvl->snap_size = size;
+  tvl->num = tvl->cap = hdr->num;
+  tvl->tvp = (tv_program *)(image + hdr->tvp_off);
+  tvl->title_num = tvl->title_cap = hdr->title_num;
+  tvl->titles = (char **)(image + hdr->titles_off);
+  tvl->ch_num = tvl->ch_cap = hdr->ch_num;
+  tvl->channels = (tv_channel *)(image + hdr->channels_off);
+  tvl->index_num = hdr->index_num;
+
+  // relocate string offsets into pointers (offsets are never shorter
+  // than pointers, so titles are relocated in place in forward order)
+  offs = (unsigned long long *)tvl->titles;
+  for (i = 0; !bad && i < tvl->title_num; i++)
+  {
+    unsigned long long off = offs[i];
+    if (off >= str_size)
+      bad = 1;
+    else
+      tvl->titles[i] = strings + off;
+  }
+  for (i = 0; !bad && i < tvl->ch_num; i++)
+  {
+    tv_channel *ch = &tvl->channels[i];
+    if ((size_t)ch->name >= str_size ||
+        ch->first > tvl->num || ch->num > tvl->num - ch->first)
+      bad = 1;
+    else
+      ch->name = strings + (size_t)ch->name;
+  }
+  for (i = 0; !bad && i < tvl->num; i++)
+  {
+    tv_program *tvp = &tvl->tvp[i];
+    if ((size_t)tvp->ch_name >= str_size || tvp->title_id >= tvl->title_num ||
+        (tvl->index_num != 0 &&
+         ((unsigned int)tvp->index_time >= tvl->num ||
+          (unsigned int)tvp->index_etime >= tvl->num)))
+      bad = 1;
+    else
+    {
+      tvp->ch_name = strings + (size_t)tvp->ch_name;
+      tvp->prg_name = tvl->titles[tvp->title_id];
+    }
+  }
+
+  if (bad)
+  {
+    // broken snapshot
+    FreeJTVSnapshot(image, size);
+    free(tvl);
+    return NULL;
+  }
+  // channels are searched linearly if there is no memory for the hash
+  BuildJTVChannelHash(tvl);
+  return tvl;
+}
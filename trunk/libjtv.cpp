@@ -1,15 +1,119 @@
 #include <iconv.h>
 #include <langinfo.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/stat.h>
+#include <zlib.h>
 #include "cs/archive.h"
 #include "strnew.h"
+#include "cpconv.h"
 #include "jtv.h"
 #include "libjtv.h"
+#include "jtvint.h"
 
 #define FILETIME_PER_SEC 10000000LL
 #define TIME_T_ZERO 0x19DB1F7FA8BB800LL // zerotime(01-01-1970) for FILETIME type
 #define HOUR_SEC 3600
+#define NDX_WINDOW_RECORDS 256 // ndx records inflated at once in stream mode
+#define POOL_BLOCK_SIZE 65536 // default size of string pool block
+
+#define TITLE_HASH_SIZE 4096 // initial size of title hash (power of 2)
+
+struct jtv_pool_block {
+  struct jtv_pool_block *next;
+  size_t size;
+  size_t used;
+  char data[1];
+};
+
+// title id of pdt string, valid if gen matches current channel
+typedef struct {
+  unsigned int gen;
+  unsigned int id;
+} jtv_seek_ref;
+
+// JTV loading state shared by parse functions
+typedef struct {
+  tv_list *tvl;
+  int correctTZ;
+  // current channel
+  char *ch_name;
+  int ch_index;
+  const char *pdt_image;
+  size_t pdt_size;
+  // title interning
+  unsigned int gen;       // channel generation for seek_map
+  jtv_seek_ref *seek_map; // str_seek -> title id
+  unsigned int *hash;     // title id + 1 by title hash (JTV_LOAD_DEDUP)
+  unsigned int hash_size;
+  unsigned int hash_used;
+  int lazy; // JTV_LOAD_LAZY, titles refer pdt records
+  cp_cnv_t cnv; // converter of parsed titles or NULL (ReloadJTV)
+  char *scratch; // conversion buffer
+  size_t scratch_size;
+  // reloading
+  tv_list *copy_from; // list unchanged channels are copied from
+  int *title_map;     // new title id by title id of copy_from, -1 if none
+  // time window (jtv_load_opts.from, to)
+  int window;
+  time_t from, to;
+  // records wait for the next one to know end of program (window, cb)
+  int lookahead;
+  NDX_RECORD pending; // the last record of channel, waits for the next one
+  int has_pending;
+  // StreamJTV
+  jtv_record_cb cb; // called for every program instead of adding it
+  void *cb_data;
+  int cb_count; // number of callback calls
+  int stop;     // set when callback stops loading
+  unsigned int failed; // parsed channels whose files couldn't be read
+  int verify; // check CRC of parsed files (ReloadJTV)
+} jtv_loader;
+
+// channel of archive: pair of its files and decode job state
+typedef struct {
+  void *ndx_entry, *pdt_entry; // archive handles
+  char *ch_name;  // decoded channel name (or alias), kept in string pool
+  int ch_index;   // alias index
+  unsigned int rec_count; // number of ndx records
+  const char *ndx_image, *pdt_image; // file images (buffers or views)
+  char *ndx_buff, *pdt_buff;         // allocated buffers of images
+  size_t ndx_size, pdt_size;
+  unsigned int ndx_crc, pdt_crc; // CRC32 of files from archive directory
+  int copy_ch; // channel of old list to copy instead of decoding, or -1
+  int done; // set by worker thread when files are decoded
+} jtv_job;
+
+// state of channel decoding shared between threads
+typedef struct {
+  csArchive *arc;
+  jtv_job *jobs;
+  unsigned int num;
+  unsigned int next;   // next job to decode
+  unsigned int parsed; // number of jobs already parsed
+  unsigned int window; // max number of jobs decoded ahead of parser
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+} jtv_decoder;
+
+// settings shared by loads, read only after NewJTVContext
+struct jtv_context_s {
+  ch_alias_list *aliases;
+  cp_cnv_t cnv_zip_fn;  // zip file names to codeset of locale
+  pthread_mutex_t lock; // converter may be iconv, loads take turns
+  size_t pool_block;    // string pool block size of lists
+};
+
+// archive of LoadJTVMulti, loaded by its own thread
+typedef struct {
+  char *fname;
+  char *ch_alias, *cp_zin_fn, *cp_content;
+  int correctTZ;
+  jtv_load_opts opts;
+  tv_list *tvl;
+  ch_alias_list *chl;
+} jtv_multi_part;
 
 char *strnewcnv(iconv_t cnv, char *str)
 {
@@ -33,13 +137,114 @@ char *strnewcnv(iconv_t cnv, char *str)
   return tmp;
 }
 
-time_t FileTime2Time_T(unsigned long long ftime, int correctTZ)
+static time_t FileTime2Time_T(unsigned long long ftime, int correctTZ)
 {
   //(correctTZ * HOUR_SEC)
     return (time_t) (((ftime - TIME_T_ZERO) / FILETIME_PER_SEC)+(correctTZ * HOUR_SEC));
 }
 
 
+/*
+ Titles, channels, channel aliases and allow-list of load are found by
+ open addressing tables of item number + 1 (0 - empty slot). Table size is
+ a power of 2, tables are kept at most half full. Items are named by
+ strings: name of item i is the pointer at names + i * stride.
+ */
+#define JTV_HASH_NAME(names, stride, i) \
+  (*(const char *const *)((const char *)(names) + (size_t)(i) * (stride)))
+
+// Size of table for num items
+static unsigned int JTVHashSize(unsigned int num)
+{
+  unsigned int size = 16;
+  while (size < num * 2)
+    size *= 2;
+  return size;
+}
+
+// Hash of len chars of str, ASCII letters are folded to lower case if fold
+static unsigned int JTVHashStr(const char *str, size_t len, int fold)
+{
+  unsigned int h = 0;
+  size_t i;
+  for (i = 0; i < len; i++)
+  {
+    unsigned char c = str[i];
+    if (fold && c >= 'A' && c <= 'Z') c += 'a' - 'A';
+    h = h * 31 + c;
+  }
+  return h;
+}
+
+// Check if 0 terminated item equals len chars of str
+static int JTVHashEq(const char *item, const char *str, size_t len, int fold)
+{
+  size_t i;
+  for (i = 0; i < len; i++)
+  {
+    unsigned char a = item[i], b = str[i];
+    if (a == 0) return 0;
+    if (fold && a >= 'A' && a <= 'Z') a += 'a' - 'A';
+    if (fold && b >= 'A' && b <= 'Z') b += 'a' - 'A';
+    if (a != b) return 0;
+  }
+  return item[len] == 0;
+}
+
+// Slot of item named as len chars of str, or the empty slot it belongs to
+static unsigned int JTVHashProbe(const unsigned int *hash, unsigned int size,
+                                 const void *names, size_t stride,
+                                 const char *str, size_t len, int fold)
+{
+  unsigned int slot = JTVHashStr(str, len, fold) & (size - 1);
+  while (hash[slot] != 0 &&
+         !JTVHashEq(JTV_HASH_NAME(names, stride, hash[slot] - 1), str, len,
+                    fold))
+    slot = (slot + 1) & (size - 1);
+  return slot;
+}
+
+// Compare channel names ignoring case of ASCII letters
+static int ChannelAliasCmp(const char *a, const char *b)
+{
+  unsigned char ca, cb;
+  do
+  {
+    ca = *a++;
+    cb = *b++;
+    if (ca >= 'A' && ca <= 'Z') ca += 'a' - 'A';
+    if (cb >= 'A' && cb <= 'Z') cb += 'a' - 'A';
+  } while (ca == cb && ca != 0);
+  return ca - cb;
+}
+
+// Build hash of zip names of alias list, returns 0 on error (aliases are
+// searched linearly then)
+static int BuildChannelAliasHash(ch_alias_list *chl)
+{
+  unsigned int i, size = JTVHashSize(chl->num);
+
+  free(chl->hash);
+  chl->hash_size = 0;
+  if ((chl->hash = (unsigned int *)calloc(size, sizeof(unsigned int))) == NULL)
+    return 0;
+  chl->hash_size = size;
+
+  for (i = 0; i < chl->num; i++)
+  {
+    unsigned int slot;
+    if (!chl->cha[i].zip_name || !chl->cha[i].real_name)
+      continue;
+    // the first of equal zip names is found, as by linear search
+    slot = JTVHashProbe(chl->hash, size, &chl->cha[0].zip_name,
+                        sizeof(ch_alias), chl->cha[i].zip_name,
+                        strlen(chl->cha[i].zip_name), 1);
+    if (chl->hash[slot] == 0)
+      chl->hash[slot] = i + 1;
+  }
+  return 1;
+}
+
 ch_alias_list * LoadChannelAliasList(char *fname,
                                      char *ext_zip_fn, char *ext_content)
 {
@@ -55,6 +260,8 @@ ch_alias_list * LoadChannelAliasList(char *fname,
       chl->cp_flags = 0;
       chl->cp_zip_fn = ext_zip_fn;
       chl->cp_content = ext_content;
+      chl->hash_size = 0;
+      chl->hash = NULL;
     }
 
     while (chl != NULL &&
@@ -88,6 +295,7 @@ ch_alias_list * LoadChannelAliasList(char *fname,
     }
     if (chl->cp_zip_fn == NULL) chl->cp_zip_fn = strnew("CP866");
     if (chl->cp_content == NULL) chl->cp_content = strnew("CP1251");
+    BuildChannelAliasHash(chl);
 
     fclose(in);
     return chl;
@@ -96,17 +304,27 @@ ch_alias_list * LoadChannelAliasList(char *fname,
   return NULL;
 }
 
-char *GetChannelAlias(ch_alias_list *chl, char *ch_name,
-                      int *index)
+static char *GetChannelAlias(ch_alias_list *chl, char *ch_name,
+                             int *index)
 {
   unsigned int i;
 
-  if (chl != NULL)
+  if (chl != NULL && chl->hash != NULL)
+  {
+    i = JTVHashProbe(chl->hash, chl->hash_size, &chl->cha[0].zip_name,
+                     sizeof(ch_alias), ch_name, strlen(ch_name), 1);
+    if (chl->hash[i] != 0)
+    {
+      if (index) *index = chl->hash[i] - 1;
+      return chl->cha[chl->hash[i] - 1].real_name;
+    }
+  }
+  else if (chl != NULL)
     for (i = 0; i < chl->num; i++)
     {
       if (chl->cha[i].zip_name &&
           chl->cha[i].real_name &&
-          strcasecmp(chl->cha[i].zip_name, ch_name) == 0)
+          ChannelAliasCmp(chl->cha[i].zip_name, ch_name) == 0)
       {
         if (index) *index = i;
         return chl->cha[i].real_name;
@@ -132,146 +350,1665 @@ void FreeChannelAliasList(ch_alias_list *ch_list)
         (ch_list->cp_flags & CP_ZIP_FN_ALLOC)) free(ch_list->cp_zip_fn);
     if (ch_list->cp_content &&
         (ch_list->cp_flags & CP_CONTENT_ALLOC)) free(ch_list->cp_content);
+    free(ch_list->hash);
     free(ch_list);
   }
 }
 
+// Allocate size bytes from string pool of list
+static char *PoolAlloc(tv_list *tvl, size_t size)
+{
+  jtv_pool_block *pb = tvl->pool;
+
+  if (pb == NULL || pb->used + size > pb->size)
+  {
+    size_t bsize = tvl->pool_block ? tvl->pool_block : POOL_BLOCK_SIZE;
+    if (bsize < size) bsize = size;
+    if ((pb = (jtv_pool_block *)malloc(sizeof(jtv_pool_block) + bsize)) == NULL)
+      return NULL;
+    pb->size = bsize;
+    pb->used = 0;
+    pb->next = tvl->pool;
+    tvl->pool = pb;
+  }
+  pb->used += size;
+  return pb->data + pb->used - size;
+}
+
+// Copy string of len chars into string pool of list
+static char *PoolStrnew(tv_list *tvl, const char *str, size_t len)
+{
+  char *tmp = PoolAlloc(tvl, len + 1);
+  if (tmp != NULL)
+  {
+    memcpy(tmp, str, len);
+    tmp[len] = 0;
+  }
+  return tmp;
+}
+
+static void FreePool(jtv_pool_block *pb)
+{
+  while (pb != NULL)
+  {
+    jtv_pool_block *next = pb->next;
+    free(pb);
+    pb = next;
+  }
+}
+
+// Check if memory belongs to snapshot list was loaded from
+static int InJTVSnapshot(tv_list *tvl, const void *ptr)
+{
+  return tvl->snap != NULL && (const char *)ptr >= tvl->snap &&
+    (const char *)ptr < tvl->snap + tvl->snap_size;
+}
+
+// Resize array of list, arrays kept in snapshot are copied out of it
+static void *JTVRealloc(tv_list *tvl, void *ptr, size_t size, size_t old_size)
+{
+  if (InJTVSnapshot(tvl, ptr))
+  {
+    void *tmp = malloc(size);
+    if (tmp != NULL)
+      memcpy(tmp, ptr, old_size < size ? old_size : size);
+    return tmp;
+  }
+  return realloc(ptr, size);
+}
+
 void FreeJTV(tv_list *tvl)
 {
-  unsigned int i;
   if (tvl)
   {
-    for (i = 0; i < tvl->num; i++)
+    unsigned int i;
+
+    FreePool(tvl->pool);
+    for (i = 0; i < tvl->buff_num; i++)
+      delete [] tvl->buffs[i];
+    if (tvl->buffs) free(tvl->buffs);
+    if (tvl->title_src) free(tvl->title_src);
+    if (tvl->cols) free(tvl->cols);
+    if (tvl->airing) free(tvl->airing);
+    if (tvl->channels && !InJTVSnapshot(tvl, tvl->channels))
+      free(tvl->channels);
+    if (tvl->ch_hash) free(tvl->ch_hash);
+    if (tvl->titles && !InJTVSnapshot(tvl, tvl->titles)) free(tvl->titles);
+    if (tvl->tvp && !InJTVSnapshot(tvl, tvl->tvp)) free(tvl->tvp);
+    if (tvl->snap) FreeJTVSnapshot(tvl->snap, tvl->snap_size);
+    free(tvl);
+  }
+}
+
+// Make room for at least count more programs in list
+static int ReserveJTV(tv_list *tvl, unsigned int count)
+{
+  if (tvl->num + count > tvl->cap)
+  {
+    unsigned int cap = tvl->cap * 2;
+    tv_program *tvp;
+
+    if (cap < tvl->num + count) cap = tvl->num + count;
+    if ((tvp = (tv_program*)JTVRealloc(tvl, tvl->tvp, cap * sizeof(tv_program),
+                                       tvl->cap * sizeof(tv_program))) == NULL)
+      return 0;
+    tvl->tvp = tvp;
+    tvl->cap = cap;
+  }
+  return 1;
+}
+
+// Number of records in ndx file of given size
+static unsigned int NDXRecordCount(size_t ndx_size)
+{
+  if (ndx_size <= sizeof(NDX_HEADER)) return 0;
+  return (ndx_size - sizeof(NDX_HEADER) + sizeof(NDX_RECORD) - 1) /
+    sizeof(NDX_RECORD);
+}
+
+// Get image of archive file. Uncompressed files of mapped archive are
+// returned as a view into the archive image and *buff is set to NULL,
+// otherwise the file is unpacked into *buff (free it with delete [])
+static const char *ReadJTVImage(csArchive *arc, void *entry,
+                                size_t *size, char **buff)
+{
+  const char *image = arc->GetView(entry, size);
+
+  *buff = NULL;
+  if (image == NULL)
+    image = *buff = arc->Read(entry, size);
+  return image;
+}
+
+// Make room for one more title in title table of list
+static int GrowJTVTitles(tv_list *tvl, int lazy)
+{
+  if (tvl->title_num == tvl->title_cap)
+  {
+    unsigned int cap = tvl->title_cap ? tvl->title_cap * 2 : 256;
+    char **titles = (char **)JTVRealloc(tvl, tvl->titles, cap * sizeof(char *),
+                                        tvl->title_cap * sizeof(char *));
+    if (titles == NULL) return 0;
+    tvl->titles = titles;
+    if (lazy)
     {
-      free(tvl->tvp[i].ch_name);
-      free(tvl->tvp[i].prg_name);
+      const char **src = (const char **)realloc(tvl->title_src,
+                                                cap * sizeof(char *));
+      if (src == NULL) return 0;
+      tvl->title_src = src;
     }
+    tvl->title_cap = cap;
+  }
+  return 1;
+}
 
-    if (tvl->tvp && tvl->num) free(tvl->tvp);
-    free(tvl);
+// Keep pdt image in list for lazy titles. Buffer is moved to the list,
+// view into archive is copied. Returns image owned by the list or NULL
+static const char *RetainJTVImage(tv_list *tvl, const char *image, size_t size,
+                                  char **buff)
+{
+  char **buffs = (char **)realloc(tvl->buffs,
+                                  (tvl->buff_num + 1) * sizeof(char *));
+  if (buffs == NULL) return NULL;
+  tvl->buffs = buffs;
+  if (*buff == NULL)
+  {
+    *buff = new char[size];
+    memcpy(*buff, image, size);
   }
+  image = tvl->buffs[tvl->buff_num++] = *buff;
+  *buff = NULL;
+  return image;
 }
 
-void ParseJTV(char *ch_name,
-              char *ndx_image, size_t ndx_size,
-              char *pdt_image, size_t pdt_size,
-              tv_list *tvl,
-              int ch_index,
-              int correctTZ)
+// Convert len chars of str by cnv into *scratch (grown if needed),
+// returns length of converted string or (size_t)-1
+static size_t CnvJTVString(cp_cnv_t cnv, const char *str, size_t len,
+                           char **scratch, size_t *scratch_size)
 {
-  size_t ndx_ptr = sizeof(NDX_HEADER);
-  int i = 0;
+  char *in = (char *)str, *out;
+  size_t out_len, need = len * 4; // enough for any charset to UTF-8
 
-  // parse ndx file image
-  while (ndx_ptr < ndx_size)
+  if (need > *scratch_size)
+  {
+    char *tmp = (char *)realloc(*scratch, need);
+    if (tmp == NULL) return (size_t)-1;
+    *scratch = tmp;
+    *scratch_size = need;
+  }
+  out = *scratch;
+  out_len = *scratch_size;
+
+  cp_cnv(cnv, NULL, NULL, NULL, NULL);
+  if (cp_cnv(cnv, &in, &len, &out, &out_len) == (size_t)(-1) ||
+      cp_cnv(cnv, NULL, NULL, &out, &out_len) == (size_t)(-1))
+    return (size_t)-1;
+  return out - *scratch;
+}
+
+// Add decoded title of len chars to title table of list, returns title id
+// or -1 on error
+static int AddJTVTitleString(jtv_loader *ld, const char *str, size_t len)
+{
+  tv_list *tvl = ld->tvl;
+  unsigned int slot = 0;
+
+  if (ld->hash != NULL)
+  {
+    // look for the same title already loaded
+    slot = JTVHashProbe(ld->hash, ld->hash_size, tvl->titles, sizeof(char *),
+                        str, len, 0);
+    if (ld->hash[slot] != 0)
+      return ld->hash[slot] - 1;
+  }
+
+  if (!GrowJTVTitles(tvl, ld->lazy) ||
+      (tvl->titles[tvl->title_num] = PoolStrnew(tvl, str, len)) == NULL)
+    return -1;
+  if (ld->lazy)
+    tvl->title_src[tvl->title_num] = NULL;
+
+  if (ld->hash != NULL)
+  {
+    ld->hash[slot] = tvl->title_num + 1;
+    // keep hash table at most half full
+    if (++ld->hash_used * 2 > ld->hash_size)
+    {
+      unsigned int n, size = ld->hash_size * 2;
+      unsigned int *hash = (unsigned int *)calloc(size, sizeof(unsigned int));
+      if (hash != NULL)
+      {
+        for (n = 0; n < ld->hash_size; n++)
+          if (ld->hash[n] != 0)
+          {
+            const char *t = tvl->titles[ld->hash[n] - 1];
+            hash[JTVHashProbe(hash, size, tvl->titles, sizeof(char *), t,
+                              strlen(t), 0)] = ld->hash[n];
+          }
+        free(ld->hash);
+        ld->hash = hash;
+        ld->hash_size = size;
+      }
+    }
+  }
+  return tvl->title_num++;
+}
+
+// Add title of pdt record to title table of list, returns title id or -1
+// on error. Lazy titles only refer pdt record, they are decoded by JTVTitle
+static int AddJTVTitle(jtv_loader *ld, const PDT_RECORD *pdt_rec)
+{
+  tv_list *tvl = ld->tvl;
+  size_t len;
+
+  if (ld->lazy)
+  {
+    if (!GrowJTVTitles(tvl, 1)) return -1;
+    tvl->titles[tvl->title_num] = NULL;
+    tvl->title_src[tvl->title_num] = (const char *)pdt_rec;
+    return tvl->title_num++;
+  }
+
+  if (ld->cnv != NULL &&
+      (len = CnvJTVString(ld->cnv, pdt_rec->str, pdt_rec->sz_str,
+                          &ld->scratch, &ld->scratch_size)) != (size_t)-1)
+    return AddJTVTitleString(ld, ld->scratch, len);
+  return AddJTVTitleString(ld, pdt_rec->str, pdt_rec->sz_str);
+}
+
+// Check if record points inside of pdt file
+static int ValidJTVRecord(jtv_loader *ld, const NDX_RECORD *ndx_rec)
+{
+  return (size_t)ndx_rec->str_seek + sizeof(PDT_RECORD) <= ld->pdt_size &&
+    (size_t)ndx_rec->str_seek + sizeof(PDT_RECORD) +
+    ((const PDT_RECORD *)(ld->pdt_image + ndx_rec->str_seek))->sz_str <=
+    ld->pdt_size;
+}
+
+static void AddJTVRecord(jtv_loader *ld, const NDX_RECORD *ndx_rec)
+{
+  tv_list *tvl = ld->tvl;
+  unsigned int sn = tvl->num;
+  jtv_seek_ref *ref;
+  int title_id;
+
+  // skip records pointing outside of pdt file
+  if (!ValidJTVRecord(ld, ndx_rec))
+    return;
+
+  // records of channel pointing to the same pdt string share one title,
+  // the map is allocated by the first parsed record (copying loads and
+  // StreamJTV never need it)
+  if (ld->seek_map == NULL &&
+      (ld->seek_map = (jtv_seek_ref *)calloc(0x10000,
+                                             sizeof(jtv_seek_ref))) == NULL)
+    return;
+  ref = &ld->seek_map[ndx_rec->str_seek];
+  if (ref->gen == ld->gen)
+    title_id = ref->id;
+  else
+  {
+    const PDT_RECORD *pdt_rec =
+      (const PDT_RECORD *)(ld->pdt_image + ndx_rec->str_seek);
+    if ((title_id = AddJTVTitle(ld, pdt_rec)) < 0)
+      return;
+    ref->gen = ld->gen;
+    ref->id = title_id;
+  }
+
+  if (!ReserveJTV(tvl, 1))
+    return;
+
+  tvl->num++;
+  tvl->tvp[sn].ch_name = ld->ch_name;
+  tvl->tvp[sn].time = FileTime2Time_T(ndx_rec->win_time, ld->correctTZ);
+  tvl->tvp[sn].etime = tvl->tvp[sn].time + 1;
+
+  // correct by daylight saving time
+  /*gmtime_r(&tvl->tvp[sn].time, &tmp);
+  tvl->tvp[sn].tm_isdst = tmp.tm_isdst;
+  if (tmp.tm_isdst == 0) tvl->tvp[sn].time = tvl->tvp[sn].time + HOUR_SEC;*/
+
+  tvl->tvp[sn].ch_index = ld->ch_index;
+  tvl->tvp[sn].prg_name = tvl->titles[title_id];
+  tvl->tvp[sn].title_id = title_id;
+}
+
+// Pass program of record to callback of loader, title is converted by
+// ld->cnv if set
+static void CallJTVRecord(jtv_loader *ld, const NDX_RECORD *ndx_rec,
+                          time_t start, time_t end)
+{
+  const PDT_RECORD *pdt_rec =
+    (const PDT_RECORD *)(ld->pdt_image + ndx_rec->str_seek);
+  const char *title = pdt_rec->str;
+  size_t len = pdt_rec->sz_str, cnv_len;
+
+  if (ld->cnv != NULL &&
+      (cnv_len = CnvJTVString(ld->cnv, title, len, &ld->scratch,
+                              &ld->scratch_size)) != (size_t)-1)
+  {
+    title = ld->scratch;
+    len = cnv_len;
+  }
+  ld->cb_count++;
+  if (ld->cb(ld->ch_name, ld->ch_index, start, end, title, len, ld->cb_data))
+    ld->stop = 1;
+}
+
+// Add record in lookahead mode. Program ends when the next one of channel
+// starts, so every record waits for the next valid one (NULL at the end of
+// channel) and is added only if its program airs inside of the window.
+// Titles of skipped records are never decoded
+static void AddJTVLookaheadRecord(jtv_loader *ld, const NDX_RECORD *ndx_rec)
+{
+  tv_list *tvl = ld->tvl;
+
+  if (ndx_rec != NULL && !ValidJTVRecord(ld, ndx_rec))
+    return;
+  if (ld->has_pending && !ld->stop)
   {
+    time_t start = FileTime2Time_T(ld->pending.win_time, ld->correctTZ);
+    time_t end = ndx_rec == NULL ? start + 1 :
+      FileTime2Time_T(ndx_rec->win_time, ld->correctTZ) - 1;
     unsigned int sn = tvl->num;
-    struct tm tmp;
-    NDX_RECORD *ndx_rec = (NDX_RECORD *) (ndx_image + ndx_ptr);
 
-    tvl->num++;
-    tvl->tvp = (tv_program*)realloc(tvl->tvp, tvl->num * sizeof(tv_program));
-    tvl->tvp[sn].ch_name = strnew(ch_name);
-    tvl->tvp[sn].time = FileTime2Time_T(ndx_rec->win_time, correctTZ);
-    tvl->tvp[sn].etime = tvl->tvp[sn].time + 1;
+    if (!ld->window ||
+        ((ld->to == 0 || start < ld->to) && end >= ld->from))
+    {
+      if (ld->cb)
+        CallJTVRecord(ld, &ld->pending, start, end);
+      else
+      {
+        AddJTVRecord(ld, &ld->pending);
+        if (tvl->num > sn)
+          tvl->tvp[sn].etime = end;
+      }
+    }
+  }
+  ld->has_pending = ndx_rec != NULL;
+  if (ndx_rec != NULL)
+  {
+    // align of the last record of file may be missing
+    ld->pending.win_time = ndx_rec->win_time;
+    ld->pending.str_seek = ndx_rec->str_seek;
+  }
+}
 
-    // correct by daylight saving time
-    /*gmtime_r(&tvl->tvp[sn].time, &tmp);
-    tvl->tvp[sn].tm_isdst = tmp.tm_isdst;
-    if (tmp.tm_isdst == 0) tvl->tvp[sn].time = tvl->tvp[sn].time + HOUR_SEC;*/
+static void ParseJTVRecord(jtv_loader *ld, const NDX_RECORD *ndx_rec)
+{
+  if (ld->lookahead)
+    AddJTVLookaheadRecord(ld, ndx_rec);
+  else
+    AddJTVRecord(ld, ndx_rec);
+}
 
-    tvl->tvp[sn].ch_index = ch_index;
+static void ParseJTV(jtv_loader *ld, const char *ndx_image, size_t ndx_size)
+{
+  size_t ndx_ptr = sizeof(NDX_HEADER);
+  int i = 0;
 
-    PDT_RECORD *pdt_rec = (PDT_RECORD *)(pdt_image + ndx_rec->str_seek);
-    tvl->tvp[sn].prg_name = (char*)malloc(pdt_rec->sz_str + 1);
-    strncpy(tvl->tvp[sn].prg_name, pdt_rec->str, pdt_rec->sz_str);
-    tvl->tvp[sn].prg_name[pdt_rec->sz_str] = 0;
+  // parse ndx file image
+  while (ndx_ptr < ndx_size && !ld->stop)
+  {
+    ParseJTVRecord(ld, (const NDX_RECORD *) (ndx_image + ndx_ptr));
 
     ndx_ptr += sizeof(NDX_RECORD);
     i++;
   }
+  if (ld->lookahead)
+    AddJTVLookaheadRecord(ld, NULL);
 //  printf("parse %d record\n",i);
 }
 
+// Same as ParseJTV, but ndx file is inflated by small windows
+// directly from the archive instead of being read whole into memory
+static void ParseJTVStream(jtv_loader *ld, csArchive *arc, void *ndx_entry)
+{
+  char window[NDX_WINDOW_RECORDS * sizeof(NDX_RECORD)];
+  size_t fill = 0, got, total;
+  uLong crc = crc32(0L, Z_NULL, 0);
+  void *ndx = arc->OpenStream(ndx_entry);
+
+  if (ndx == NULL)
+  {
+    ld->failed++;
+    return;
+  }
+
+  // skip ndx header
+  if ((total = arc->ReadStream(ndx, window, sizeof(NDX_HEADER))) ==
+      sizeof(NDX_HEADER))
+  {
+    if (ld->verify)
+      crc = crc32(crc, (const Bytef *)window, sizeof(NDX_HEADER));
+    do
+    {
+      size_t ndx_ptr = 0;
+
+      got = arc->ReadStream(ndx, window + fill, sizeof(window) - fill);
+      if (ld->verify)
+        crc = crc32(crc, (const Bytef *)window + fill, got);
+      fill += got;
+      total += got;
+      // the last record of file may be incomplete (see ParseJTV)
+      if (got == 0 && fill != 0)
+      {
+        memset(window + fill, 0, sizeof(NDX_RECORD) - fill);
+        fill = sizeof(NDX_RECORD);
+      }
+
+      while (ndx_ptr + sizeof(NDX_RECORD) <= fill && !ld->stop)
+      {
+        ParseJTVRecord(ld, (const NDX_RECORD *) (window + ndx_ptr));
+        ndx_ptr += sizeof(NDX_RECORD);
+      }
+
+      fill -= ndx_ptr;
+      memmove(window, window + ndx_ptr, fill);
+    } while (got != 0 && !ld->stop);
+  }
+  // stream ends early on read errors
+  if (!ld->stop && (total != arc->GetFileSize(ndx_entry) ||
+                    (ld->verify && crc != arc->GetFileCRC(ndx_entry))))
+    ld->failed++;
+  if (ld->lookahead)
+    AddJTVLookaheadRecord(ld, NULL);
+
+  arc->CloseStream(ndx);
+}
+
+// Key of snapshot of archive loaded with given parameters, returns 0 if
+// archive file can't be checked
+static int MakeJTVSnapKey(const char *fname, csArchive *arc, ch_alias_list *chl,
+                          int correctTZ, int flags, jtv_load_opts *opts,
+                          jtv_snap_key *key)
+{
+  const char *codeset = nl_langinfo(_NL_MESSAGES_CODESET);
+  time_t from = opts ? opts->from : 0, to = opts ? opts->to : 0;
+  uLong crc = crc32(0L, Z_NULL, 0);
+  struct stat st;
+  unsigned int i;
+  void *ae;
+
+  if (stat(fname, &st) != 0)
+    return 0;
+  memset(key, 0, sizeof(*key));
+  key->arc_size = st.st_size;
+  key->arc_mtime = st.st_mtime;
+
+  for (i = 0; (ae = arc->GetFile(i)) != NULL; i++)
+  {
+    const char *name = arc->GetFileName(ae);
+    unsigned int file_crc = arc->GetFileCRC(ae);
+    crc = crc32(crc, (const Bytef *)name, strlen(name) + 1);
+    crc = crc32(crc, (const Bytef *)&file_crc, sizeof(file_crc));
+  }
+  key->dir_crc = crc;
+
+  // lazy titles are stored decoded, so JTV_LOAD_LAZY doesn't matter
+  flags &= JTV_LOAD_DEDUP | JTV_LOAD_INDEX;
+  crc = crc32(0L, Z_NULL, 0);
+  crc = crc32(crc, (const Bytef *)&correctTZ, sizeof(correctTZ));
+  crc = crc32(crc, (const Bytef *)&flags, sizeof(flags));
+  crc = crc32(crc, (const Bytef *)&from, sizeof(from));
+  crc = crc32(crc, (const Bytef *)&to, sizeof(to));
+  for (i = 0; opts && opts->channels && i < opts->channel_num; i++)
+    crc = crc32(crc, (const Bytef *)opts->channels[i],
+                strlen(opts->channels[i]) + 1);
+  crc = crc32(crc, (const Bytef *)codeset, strlen(codeset) + 1);
+  if (chl != NULL)
+  {
+    crc = crc32(crc, (const Bytef *)chl->cp_zip_fn, strlen(chl->cp_zip_fn) + 1);
+    for (i = 0; i < chl->num; i++)
+      if (chl->cha[i].zip_name && chl->cha[i].real_name)
+      {
+        crc = crc32(crc, (const Bytef *)chl->cha[i].zip_name,
+                    strlen(chl->cha[i].zip_name) + 1);
+        crc = crc32(crc, (const Bytef *)chl->cha[i].real_name,
+                    strlen(chl->cha[i].real_name) + 1);
+      }
+  }
+  key->opts_crc = crc;
+  return 1;
+}
+
 tv_list *LoadJTV(char *fname, char *ch_alias, int correctTZ,
                  char *cp_zin_fn, char *cp_content,
                  ch_alias_list **out_chl)
 {
-  tv_list *tvl = (tv_list *)malloc(sizeof(tv_list));
-  if (!tvl) return NULL;
-  tvl->num = 0;
-  tvl->tvp = NULL;
-  csArchive *jtvFile = new csArchive(fname);
-
-  ch_alias_list *chl = LoadChannelAliasList(ch_alias, cp_zin_fn, cp_content);
-  if (out_chl) *out_chl = chl;
-  iconv_t cnv_zip_fn = iconv_open(nl_langinfo(_NL_MESSAGES_CODESET),
-                                  chl->cp_zip_fn);
-  if (cnv_zip_fn != (iconv_t) -1)
-  {
-    int i = 0;
-    void *ae;
-    // while file in vector exist
-    while((ae = jtvFile->GetFile(i)) != NULL)
+  return LoadJTVEx(fname, ch_alias, correctTZ, cp_zin_fn, cp_content,
+                   out_chl, NULL);
+}
+
+// Add channel of job to channel table of list, its programs start from
+// the end of list. Returns channel number or -1 on error
+static int AddJTVChannel(tv_list *tvl, const jtv_job *job)
+{
+  tv_channel *ch;
+
+  if (tvl->ch_num == tvl->ch_cap)
+  {
+    unsigned int cap = tvl->ch_cap ? tvl->ch_cap * 2 : 64;
+    if ((ch = (tv_channel *)JTVRealloc(tvl, tvl->channels,
+                                       cap * sizeof(tv_channel),
+                                       tvl->ch_cap * sizeof(tv_channel))) == NULL)
+      return -1;
+    tvl->channels = ch;
+    tvl->ch_cap = cap;
+  }
+  ch = &tvl->channels[tvl->ch_num];
+  ch->name = job->ch_name;
+  ch->ch_index = job->ch_index;
+  ch->first = tvl->num;
+  ch->num = 0;
+  ch->ndx_crc = job->ndx_crc;
+  ch->pdt_crc = job->pdt_crc;
+  ch->ndx_size = job->ndx_size;
+  ch->pdt_size = job->pdt_size;
+  return tvl->ch_num++;
+}
+
+// Build hash of channel names of list, returns 0 on error
+int BuildJTVChannelHash(tv_list *tvl)
+{
+  unsigned int i, size = JTVHashSize(tvl->ch_num);
+
+  if (size != tvl->ch_hash_size)
+  {
+    unsigned int *hash = (unsigned int *)realloc(tvl->ch_hash,
+                                                 size * sizeof(unsigned int));
+    if (hash == NULL) return 0;
+    tvl->ch_hash = hash;
+    tvl->ch_hash_size = size;
+  }
+  memset(tvl->ch_hash, 0, size * sizeof(unsigned int));
+
+  for (i = 0; i < tvl->ch_num; i++)
+  {
+    // the first of equally named channels is found
+    unsigned int slot = JTVHashProbe(tvl->ch_hash, size,
+                                     &tvl->channels[0].name,
+                                     sizeof(tv_channel), tvl->channels[i].name,
+                                     strlen(tvl->channels[i].name), 0);
+    if (tvl->ch_hash[slot] == 0)
+      tvl->ch_hash[slot] = i + 1;
+  }
+  return 1;
+}
+
+// Channel number by name, -1 if list has no such channel. The hash is
+// built by loaders, channels are searched linearly without it (the list
+// isn't changed, so lookups may run in parallel)
+int JTVFindChannel(tv_list *tvl, const char *name)
+{
+  unsigned int slot;
+
+  if (tvl->ch_hash == NULL || tvl->ch_num == 0)
+  {
+    unsigned int i;
+    for (i = 0; i < tvl->ch_num; i++)
+      if (strcmp(tvl->channels[i].name, name) == 0)
+        return i;
+    return -1;
+  }
+  slot = JTVHashProbe(tvl->ch_hash, tvl->ch_hash_size, &tvl->channels[0].name,
+                      sizeof(tv_channel), name, strlen(name), 0);
+  return tvl->ch_hash[slot] != 0 ? (int)tvl->ch_hash[slot] - 1 : -1;
+}
+
+// Programs of channel ch, their number is stored into *num
+tv_program *JTVChannelSpan(tv_list *tvl, unsigned int ch, unsigned int *num)
+{
+  if (ch >= tvl->ch_num)
+  {
+    *num = 0;
+    return NULL;
+  }
+  *num = tvl->channels[ch].num;
+  return tvl->tvp + tvl->channels[ch].first;
+}
+
+// Build hash of channel allow-list of load (index + 1 by ASCII case folded
+// name hash), returns NULL if there is no allow-list or no memory
+static unsigned int *BuildJTVChannelFilter(jtv_load_opts *opts,
+                                           unsigned int *size)
+{
+  unsigned int i, *filter;
+
+  *size = 0;
+  if (!opts || !opts->channels || opts->channel_num == 0)
+    return NULL;
+  *size = JTVHashSize(opts->channel_num);
+  if ((filter = (unsigned int *)calloc(*size, sizeof(unsigned int))) == NULL)
+    return NULL;
+  for (i = 0; i < opts->channel_num; i++)
+  {
+    unsigned int slot = JTVHashProbe(filter, *size, opts->channels,
+                                     sizeof(char *), opts->channels[i],
+                                     strlen(opts->channels[i]), 1);
+    if (filter[slot] == 0)
+      filter[slot] = i + 1;
+  }
+  return filter;
+}
+
+// Check if channel name is in allow-list of load
+static int JTVChannelAllowed(jtv_load_opts *opts, unsigned int *filter,
+                             unsigned int size, const char *name)
+{
+  unsigned int i;
+
+  if (!opts || !opts->channels || opts->channel_num == 0)
+    return 1;
+  if (filter == NULL)
+  {
+    for (i = 0; i < opts->channel_num; i++)
+      if (ChannelAliasCmp(opts->channels[i], name) == 0)
+        return 1;
+    return 0;
+  }
+  return filter[JTVHashProbe(filter, size, opts->channels, sizeof(char *),
+                             name, strlen(name), 1)] != 0;
+}
+
+// Scan archive directory once and build table of channels having both
+// ndx and pdt files. Channel names are decoded and aliased here, so later
+// stages don't touch the directory again. Channels missing in allow-list
+// of opts are skipped, so their files are never read. Returns number of
+// channels
+static unsigned int ScanJTVDirectory(csArchive *arc, cp_cnv_t cnv_zip_fn,
+                                     pthread_mutex_t *lock,
+                                     ch_alias_list *chl, jtv_load_opts *opts,
+                                     tv_list *tvl, jtv_job **out_jobs)
+{
+  char name[MAXPATHLEN];
+  unsigned int num = 0, filter_size;
+  unsigned int *filter = BuildJTVChannelFilter(opts, &filter_size);
+  jtv_job *jobs = NULL;
+  void *ae;
+  int i;
+
+  for (i = 0; (ae = arc->GetFile(i)) != NULL; i++)
+  {
+    char *fndx_name = arc->GetFileName(ae);
+    size_t len = strlen(fndx_name);
+    void *pdt_entry;
+    char *ch_name, *alias;
+    jtv_job *job;
+
+    if (len <= 4 || len >= sizeof(name) ||
+        strcmp(fndx_name + len - 4, ".ndx") != 0)
+      continue;
+
+    memcpy(name, fndx_name, len - 4);
+    strcpy(name + len - 4, ".pdt");
+    if ((pdt_entry = arc->FindName(name)) == NULL)
+      continue;
+
+    if (num % 64 == 0)
     {
-      char *fndx_name = jtvFile->GetFileName(ae);
-      //    printf("%d. %s \n",i, fndx_name);
-      if (strstr(fndx_name, ".ndx") != NULL)
-      {
-        //      printf ("processing %s...\n",fndx_name);
-        char *fpdt_name = strnew(fndx_name);
-        strcpy(strstr(fpdt_name, ".ndx"), ".pdt");
-        //      printf("generate %s\n",fpdt_name);
-
-        // 1. check files exist (both ndx and pdt)
-        if (jtvFile->FileExists(fndx_name, NULL) &&
-            jtvFile->FileExists(fpdt_name, NULL))
-        {
-          // 2. read files into memory
-          size_t ndx_size = 0, pdt_size = 0;
-          char *ndx_image = NULL, *pdt_image = NULL;
-          if ((ndx_image = jtvFile->Read(fndx_name, &ndx_size)) != NULL &&
-              ndx_size != 0)
-          {
-            if ((pdt_image = jtvFile->Read(fpdt_name, &pdt_size)) != NULL &&
-                pdt_size != 0)
-            {
-              char *ch_name = strnewcnv(cnv_zip_fn, fpdt_name);
-              if (ch_name)
-              {
-                char *c = strstr(ch_name,".pdt");
-                *c = 0;
-                int ch_index;
-                char *alias = GetChannelAlias(chl, ch_name, &ch_index);
-                //            printf("Channel name %s \n", ch_name);
-
-                ParseJTV(alias, ndx_image, ndx_size,
-                         pdt_image, pdt_size,
-                         tvl, ch_index, correctTZ);
-
-                free(ch_name);
-              }
-              delete [] pdt_image;
-            }
-
-            delete [] ndx_image;
-          }
+      jtv_job *tmp = (jtv_job *)realloc(jobs, (num + 64) * sizeof(jtv_job));
+      if (tmp == NULL) break;
+      jobs = tmp;
+    }
+    job = &jobs[num];
+    memset(job, 0, sizeof(jtv_job));
 
-        }
+    name[len - 4] = 0;
+    if (lock) pthread_mutex_lock(lock);
+    ch_name = cp_strnew(cnv_zip_fn, name);
+    if (lock) pthread_mutex_unlock(lock);
+    if (ch_name == NULL)
+      continue;
+    alias = GetChannelAlias(chl, ch_name, &job->ch_index);
+    // channel is allowed by its zip name or alias
+    if (!JTVChannelAllowed(opts, filter, filter_size, ch_name) &&
+        (alias == ch_name ||
+         !JTVChannelAllowed(opts, filter, filter_size, alias)))
+    {
+      free(ch_name);
+      continue;
+    }
+    // channel name is stored once for all its programs
+    job->ch_name = PoolStrnew(tvl, alias, strlen(alias));
+    free(ch_name);
+    if (job->ch_name == NULL)
+      continue;
+
+    job->ndx_entry = ae;
+    job->pdt_entry = pdt_entry;
+    job->ndx_size = arc->GetFileSize(ae);
+    job->pdt_size = arc->GetFileSize(pdt_entry);
+    job->ndx_crc = arc->GetFileCRC(ae);
+    job->pdt_crc = arc->GetFileCRC(pdt_entry);
+    job->rec_count = NDXRecordCount(job->ndx_size);
+    job->copy_ch = -1;
+    num++;
+  }
+
+  free(filter);
+  *out_jobs = jobs;
+  return num;
+}
+
+// Read both files of channel into memory. In stream mode ndx file
+// is not read here, it is inflated later while parsing
+static void DecodeJTVJob(csArchive *arc, jtv_job *job, int stream)
+{
+  if (job->copy_ch >= 0)
+    return;
+  if (stream)
+    job->ndx_image = "";
+  else
+    job->ndx_image = ReadJTVImage(arc, job->ndx_entry,
+                                  &job->ndx_size, &job->ndx_buff);
+  if (job->ndx_image != NULL && job->ndx_size != 0)
+    job->pdt_image = ReadJTVImage(arc, job->pdt_entry,
+                                  &job->pdt_size, &job->pdt_buff);
+}
+
+// Worker thread of parallel loading: decodes channels in archive order,
+// staying at most dc->window channels ahead of the parser
+static void *DecodeJTVThread(void *arg)
+{
+  jtv_decoder *dc = (jtv_decoder *)arg;
+  unsigned int j;
+
+  pthread_mutex_lock(&dc->lock);
+  for (;;)
+  {
+    while (dc->next < dc->num && dc->next >= dc->parsed + dc->window)
+      pthread_cond_wait(&dc->cond, &dc->lock);
+    if (dc->next >= dc->num) break;
+    j = dc->next++;
+    pthread_mutex_unlock(&dc->lock);
+
+    // archive reads are reentrant, all workers share one archive
+    DecodeJTVJob(dc->arc, &dc->jobs[j], 0);
+
+    pthread_mutex_lock(&dc->lock);
+    dc->jobs[j].done = 1;
+    pthread_cond_broadcast(&dc->cond);
+  }
+  pthread_mutex_unlock(&dc->lock);
+  return NULL;
+}
+
+// Open archive of load: mapped unless JTV_LOAD_STDIO is given
+static csArchive *JTVOpenArchive(char *fname, int flags)
+{
+  return new csArchive(fname, (flags & JTV_LOAD_STDIO) ? csArchive::omStdio :
+                       csArchive::omMapped);
+}
+
+// Allocate empty list for load with options opts
+static tv_list *NewJTV(jtv_load_opts *opts)
+{
+  tv_list *tvl = (tv_list *)calloc(1, sizeof(tv_list));
+  if (tvl && opts && opts->context)
+    tvl->pool_block = opts->context->pool_block;
+  return tvl;
+}
+
+// Channel aliases of load: shared aliases of context or options,
+// otherwise they are loaded from alias file and *shared is cleared
+static ch_alias_list *JTVLoadAliases(jtv_load_opts *opts, char *ch_alias,
+                                     char *cp_zin_fn, char *cp_content,
+                                     int *shared)
+{
+  *shared = 1;
+  if (opts && opts->context)
+    return opts->context->aliases;
+  if (opts && opts->aliases)
+    return opts->aliases;
+  *shared = 0;
+  return LoadChannelAliasList(ch_alias, cp_zin_fn, cp_content);
+}
+
+// Converter of zip file names of load, (cp_cnv_t)-1 on error. Converter of
+// context is shared, *lock is set to mutex guarding it then
+static cp_cnv_t JTVOpenZipCnv(jtv_load_opts *opts, ch_alias_list *chl,
+                              pthread_mutex_t **lock)
+{
+  *lock = NULL;
+  if (opts && opts->context)
+  {
+    *lock = &opts->context->lock;
+    return opts->context->cnv_zip_fn;
+  }
+  return cp_cnv_open(nl_langinfo(_NL_MESSAGES_CODESET), chl->cp_zip_fn);
+}
+
+static void JTVCloseZipCnv(cp_cnv_t cnv, pthread_mutex_t *lock)
+{
+  if (lock == NULL)
+    cp_cnv_close(cnv);
+}
+
+static void FreeJTVLoader(jtv_loader *ld)
+{
+  free(ld->seek_map);
+  free(ld->hash);
+  free(ld->scratch);
+}
+
+// Prepare loader of list for load with options opts, flags are corrected
+// for it. Returns 0 on error
+static int InitJTVLoader(jtv_loader *ld, tv_list *tvl, int correctTZ,
+                         jtv_load_opts *opts, int *flags)
+{
+  memset(ld, 0, sizeof(*ld));
+  ld->tvl = tvl;
+  ld->correctTZ = correctTZ;
+  tvl->correctTZ = correctTZ;
+  if (opts && (opts->from != 0 || opts->to != 0))
+  {
+    ld->window = ld->lookahead = 1;
+    ld->from = opts->from;
+    ld->to = opts->to;
+  }
+  tvl->from = ld->from;
+  tvl->to = ld->to;
+  // equal titles can't be found without decoding them
+  if (*flags & JTV_LOAD_LAZY)
+  {
+    ld->lazy = 1;
+    *flags &= ~JTV_LOAD_DEDUP;
+  }
+  if (*flags & JTV_LOAD_DEDUP)
+  {
+    ld->hash_size = TITLE_HASH_SIZE;
+    ld->hash = (unsigned int *)calloc(ld->hash_size, sizeof(unsigned int));
+  }
+  if ((*flags & JTV_LOAD_DEDUP) && ld->hash == NULL)
+  {
+    FreeJTVLoader(ld);
+    return 0;
+  }
+  return 1;
+}
+
+// Copy program of ld->copy_from list to the end of list. Titles are copied
+// decoded, so they are neither parsed nor converted again
+static void CopyJTVProgram(jtv_loader *ld, tv_program *tvp)
+{
+  tv_list *tvl = ld->tvl;
+  int title_id = ld->title_map[tvp->title_id];
+
+  if (title_id < 0)
+  {
+    char *title = JTVTitle(ld->copy_from, tvp);
+    if (title == NULL ||
+        (title_id = AddJTVTitleString(ld, title, strlen(title))) < 0)
+      return;
+    ld->title_map[tvp->title_id] = title_id;
+  }
+  if (!ReserveJTV(tvl, 1))
+    return;
+
+  tvl->tvp[tvl->num] = *tvp;
+  tvl->tvp[tvl->num].ch_name = ld->ch_name;
+  tvl->tvp[tvl->num].ch_index = ld->ch_index;
+  tvl->tvp[tvl->num].prg_name = tvl->titles[title_id];
+  tvl->tvp[tvl->num].title_id = title_id;
+  tvl->num++;
+}
+
+// Copy programs of channel ch of ld->copy_from list to the end of list
+static void CopyJTVChannel(jtv_loader *ld, tv_channel *ch)
+{
+  unsigned int i;
+
+  for (i = ch->first; i < ch->first + ch->num; i++)
+    CopyJTVProgram(ld, &ld->copy_from->tvp[i]);
+}
+
+// Check CRC of files of parsed channel against the archive directory if
+// loader verifies them (stream ndx file is checked by ParseJTVStream)
+static int JTVJobIntact(jtv_loader *ld, const jtv_job *job, int stream)
+{
+  uLong crc = crc32(0L, Z_NULL, 0);
 
-        free(fpdt_name);
+  if (!ld->verify)
+    return 1;
+  return crc32(crc, (const Bytef *)job->pdt_image, job->pdt_size) ==
+    job->pdt_crc &&
+    (stream ||
+     crc32(crc, (const Bytef *)job->ndx_image, job->ndx_size) == job->ndx_crc);
+}
+
+// Decode and parse channels of jobs into list of loader in archive order.
+// Jobs with copy_ch >= 0 aren't decoded, their channel is copied from
+// ld->copy_from list instead. Channels which can't be read are counted in
+// ld->failed
+static void LoadJTVChannels(jtv_loader *ld, csArchive *arc, jtv_job *jobs,
+                            unsigned int num, int flags, int threads)
+{
+  tv_list *tvl = ld->tvl;
+  unsigned int j, count = 0;
+  int i, ch, empty;
+  jtv_decoder dc;
+  pthread_t *tid = NULL;
+
+  memset(&dc, 0, sizeof(dc));
+  dc.arc = arc;
+  dc.jobs = jobs;
+  dc.num = num;
+
+  // reserve list for all programs of archive at once (in lookahead mode
+  // only a part of them is added, if any)
+  for (j = 0; j < num && !ld->lookahead; j++)
+    count += jobs[j].rec_count;
+  ReserveJTV(tvl, count);
+
+  // start decoding threads
+  if (threads > 1 && num > 1)
+  {
+    dc.window = threads * 2;
+    pthread_mutex_init(&dc.lock, NULL);
+    pthread_cond_init(&dc.cond, NULL);
+    if ((tid = (pthread_t *)malloc(threads * sizeof(pthread_t))) != NULL)
+      for (i = 0; i < threads; i++)
+        if (pthread_create(&tid[i], NULL, DecodeJTVThread, &dc) != 0)
+          break;
+    // run serially if no thread could be started
+    if ((threads = tid ? i : 0) == 0)
+    {
+      free(tid);
+      tid = NULL;
+      pthread_cond_destroy(&dc.cond);
+      pthread_mutex_destroy(&dc.lock);
+    }
+  }
+
+  // parse channels in archive order
+  for (j = 0; j < num && !ld->stop; j++)
+  {
+    jtv_job *job = &jobs[j];
+
+    if (tid)
+    {
+      pthread_mutex_lock(&dc.lock);
+      while (!job->done)
+        pthread_cond_wait(&dc.cond, &dc.lock);
+      pthread_mutex_unlock(&dc.lock);
+    }
+    else
+      DecodeJTVJob(arc, job, flags & JTV_LOAD_STREAM);
+
+    ch = -1;
+    ld->ch_name = job->ch_name;
+    ld->ch_index = job->ch_index;
+    if (job->copy_ch >= 0)
+    {
+      if ((ch = AddJTVChannel(tvl, job)) >= 0)
+        CopyJTVChannel(ld, &ld->copy_from->channels[job->copy_ch]);
+    }
+    else if (job->ndx_image != NULL && job->ndx_size != 0 &&
+             job->pdt_image != NULL && job->pdt_size != 0 &&
+             JTVJobIntact(ld, job, !tid && (flags & JTV_LOAD_STREAM)))
+    {
+      ld->pdt_image = job->pdt_image;
+      ld->pdt_size = job->pdt_size;
+      // lazy titles refer pdt file after archive is closed
+      if (ld->lazy)
+        ld->pdt_image = RetainJTVImage(tvl, job->pdt_image, job->pdt_size,
+                                       &job->pdt_buff);
+      if (ld->pdt_image != NULL && (ch = AddJTVChannel(tvl, job)) >= 0)
+      {
+        ld->gen++;
+        if (!ld->lookahead)
+          ReserveJTV(tvl, job->rec_count);
+        if (!tid && (flags & JTV_LOAD_STREAM))
+          ParseJTVStream(ld, arc, job->ndx_entry);
+        else
+          ParseJTV(ld, job->ndx_image, job->ndx_size);
       }
-      i++;
     }
+    // empty files are not an error, the channel has no programs then
+    empty = job->ndx_image != NULL &&
+      (job->ndx_size == 0 || (job->pdt_image != NULL && job->pdt_size == 0));
+    if (ch < 0 && job->copy_ch < 0 && !empty)
+      ld->failed++;
+    if (ch >= 0)
+      tvl->channels[ch].num = tvl->num - tvl->channels[ch].first;
+    delete [] job->pdt_buff;
+    delete [] job->ndx_buff;
+
+    if (tid)
+    {
+      pthread_mutex_lock(&dc.lock);
+      dc.parsed++;
+      pthread_cond_broadcast(&dc.cond);
+      pthread_mutex_unlock(&dc.lock);
+    }
+  }
+
+  if (tid)
+  {
+    // parsing may be stopped, workers take no more jobs then
+    pthread_mutex_lock(&dc.lock);
+    dc.next = num;
+    pthread_cond_broadcast(&dc.cond);
+    pthread_mutex_unlock(&dc.lock);
+    for (i = 0; i < threads; i++)
+      pthread_join(tid[i], NULL);
+    free(tid);
+    pthread_cond_destroy(&dc.cond);
+    pthread_mutex_destroy(&dc.lock);
+  }
+  // jobs decoded ahead of stopped parser
+  for (; j < num; j++)
+  {
+    delete [] jobs[j].pdt_buff;
+    delete [] jobs[j].ndx_buff;
+  }
+}
+
+// Complete list after all channels are loaded
+static void FinishJTV(tv_list *tvl, int flags)
+{
+  unsigned int i, j;
+
+  // program ends when the next one of its channel starts
+  for (i = 0; i < tvl->ch_num; i++)
+  {
+    tv_channel *ch = &tvl->channels[i];
+    for (j = ch->first; j + 1 < ch->first + ch->num; j++)
+      tvl->tvp[j].etime = tvl->tvp[j + 1].time - 1;
+  }
+  BuildJTVChannelHash(tvl);
+
+  if (flags & JTV_LOAD_INDEX)
+    BuildJTVIndex(tvl);
+}
 
-    if (tvl->num)
-      for (i = 0; i< tvl->num - 1; i++)
-        if (tvl->tvp[i].ch_index == tvl->tvp[i + 1].ch_index)
-          tvl->tvp[i].etime = tvl->tvp[i + 1].time - 1;
+tv_list *LoadJTVEx(char *fname, char *ch_alias, int correctTZ,
+                   char *cp_zin_fn, char *cp_content,
+                   ch_alias_list **out_chl, jtv_load_opts *opts)
+{
+  int flags = opts ? opts->flags : 0;
+  int threads = opts ? opts->threads : 0;
+  jtv_loader ld;
+  pthread_mutex_t *lock;
+  int shared;
+  tv_list *tvl = NewJTV(opts);
+  if (!tvl) return NULL;
+  if (!InitJTVLoader(&ld, tvl, correctTZ, opts, &flags))
+  {
+    free(tvl);
+    return NULL;
+  }
+  csArchive *jtvFile = JTVOpenArchive(fname, flags);
+
+  ch_alias_list *chl = JTVLoadAliases(opts, ch_alias, cp_zin_fn, cp_content,
+                                      &shared);
+  if (out_chl) *out_chl = shared ? NULL : chl;
 
-    iconv_close(cnv_zip_fn);
+  // reuse snapshot of the same archive loaded with the same parameters
+  jtv_snap_key key;
+  tv_list *snap = NULL;
+  int use_cache = opts && opts->cache &&
+    MakeJTVSnapKey(fname, jtvFile, chl, correctTZ, flags, opts, &key);
+  if (use_cache && (snap = LoadJTVSnapshot(opts->cache, &key)) != NULL)
+  {
+    snap->pool_block = tvl->pool_block;
+    FreeJTV(tvl);
+    tvl = snap;
+    tvl->correctTZ = correctTZ;
+    tvl->from = ld.from;
+    tvl->to = ld.to;
+  }
+
+  cp_cnv_t cnv_zip_fn = snap ? (cp_cnv_t) -1 :
+    JTVOpenZipCnv(opts, chl, &lock);
+  if (cnv_zip_fn != (cp_cnv_t) -1)
+  {
+    jtv_job *jobs;
+    // collect channels having both ndx and pdt files
+    unsigned int num = ScanJTVDirectory(jtvFile, cnv_zip_fn, lock, chl, opts,
+                                        tvl, &jobs);
+
+    LoadJTVChannels(&ld, jtvFile, jobs, num, flags, threads);
+    free(jobs);
+    FinishJTV(tvl, flags);
+    if (use_cache)
+      SaveJTVSnapshot(tvl, opts->cache, &key);
+
+    JTVCloseZipCnv(cnv_zip_fn, lock);
   }
   //FreeChannelAliasList(chl);
+  FreeJTVLoader(&ld);
+  delete jtvFile;
+  return tvl;
+}
+
+// Reload list from replaced archive. Channels whose both files have the
+// same CRC and size in the archive directory are copied from the list,
+// only changed and new channels are parsed. Titles of parsed channels are
+// converted by cnv, if not NULL (pass the converter given to
+// ConvertJTVTitles for the list, title_cnv of list is kept). Columns,
+// sort index and airing index the list had are rebuilt. The snapshot of
+// opts isn't written for lists with converted titles. Contents of the list
+// are replaced in place, so unlike queries reload needs exclusive access:
+// no other thread may use the list during the call. Returns number of
+// parsed channels or -1 on error, the list is left as it was then.
+// Archive without channels or central directory (e.g. truncated while it
+// is replaced) and files of parsed channels which can't be read or don't
+// match their CRC are errors, so channels are never lost silently
+int ReloadJTV(tv_list *tvl, char *fname, char *ch_alias, int correctTZ,
+              char *cp_zin_fn, char *cp_content, jtv_load_opts *opts,
+              cp_cnv_t cnv)
+{
+  int flags = opts ? opts->flags : 0;
+  int threads = opts ? opts->threads : 0;
+  int parsed = -1, shared;
+  struct stat st;
+  pthread_mutex_t *lock;
+  jtv_loader ld;
+  tv_list *nl;
+
+  // archive may be missing while it is being replaced
+  if (stat(fname, &st) != 0 || (nl = NewJTV(opts)) == NULL)
+    return -1;
+  // titles of converted list are decoded already
+  if (cnv != NULL)
+    flags &= ~JTV_LOAD_LAZY;
+  if (!InitJTVLoader(&ld, nl, correctTZ, opts, &flags))
+  {
+    free(nl);
+    return -1;
+  }
+  nl->title_cnv = tvl->title_cnv;
+  nl->converted = tvl->converted || cnv != NULL;
+  ld.cnv = cnv;
+  ld.copy_from = tvl;
+  // replaced archive may be read while it is being written
+  ld.verify = 1;
+  ld.title_map = (int *)malloc((tvl->title_num + 1) * sizeof(int));
+  csArchive *jtvFile = JTVOpenArchive(fname, flags);
+
+  ch_alias_list *chl = JTVLoadAliases(opts, ch_alias, cp_zin_fn, cp_content,
+                                      &shared);
+  cp_cnv_t cnv_zip_fn = chl == NULL || ld.title_map == NULL ? (cp_cnv_t) -1 :
+    JTVOpenZipCnv(opts, chl, &lock);
+  if (cnv_zip_fn != (cp_cnv_t) -1)
+  {
+    jtv_job *jobs;
+    jtv_snap_key key;
+    unsigned int i, num = ScanJTVDirectory(jtvFile, cnv_zip_fn, lock, chl,
+                                           opts, nl, &jobs);
+
+    // broken archive must not empty the list or drop its channels
+    if (num == 0 || !jtvFile->HasCentralDirectory())
+    {
+      free(jobs);
+      JTVCloseZipCnv(cnv_zip_fn, lock);
+      goto done;
+    }
+    memset(ld.title_map, -1, tvl->title_num * sizeof(int));
+    parsed = num;
+    // times of programs depend on time zone correction and window
+    for (i = 0; i < num && tvl->correctTZ == correctTZ &&
+           tvl->from == ld.from && tvl->to == ld.to; i++)
+    {
+      int ch = JTVFindChannel(tvl, jobs[i].ch_name);
+      if (ch >= 0 &&
+          tvl->channels[ch].ndx_crc == jobs[i].ndx_crc &&
+          tvl->channels[ch].pdt_crc == jobs[i].pdt_crc &&
+          tvl->channels[ch].ndx_size == jobs[i].ndx_size &&
+          tvl->channels[ch].pdt_size == jobs[i].pdt_size)
+      {
+        jobs[i].copy_ch = ch;
+        parsed--;
+      }
+    }
+
+    LoadJTVChannels(&ld, jtvFile, jobs, num, flags, threads);
+    free(jobs);
+    if (ld.failed)
+    {
+      parsed = -1;
+      JTVCloseZipCnv(cnv_zip_fn, lock);
+      goto done;
+    }
+    FinishJTV(nl, flags);
+    // snapshot is loaded instead of raw titles by the same key
+    if (opts && opts->cache && !nl->converted && nl->title_cnv == NULL &&
+        MakeJTVSnapKey(fname, jtvFile, chl, correctTZ, flags, opts, &key))
+      SaveJTVSnapshot(nl, opts->cache, &key);
+    JTVCloseZipCnv(cnv_zip_fn, lock);
+
+    // queries never build indexes, keep the ones the list had
+    if (tvl->cols != NULL)
+      BuildJTVColumns(nl);
+    if (tvl->num != 0 && tvl->index_num == tvl->num && nl->index_num != nl->num)
+      BuildJTVIndex(nl);
+    if (tvl->airing != NULL)
+      BuildJTVAiringIndex(nl);
+
+    // new contents replace old ones, so users keep pointer to the list
+    tv_list tmp = *tvl;
+    *tvl = *nl;
+    *nl = tmp;
+  }
+done:
+  if (!shared)
+    FreeChannelAliasList(chl);
+  free(ld.title_map);
+  FreeJTVLoader(&ld);
+  FreeJTV(nl);
   delete jtvFile;
+  return parsed;
+}
+
+static void *LoadJTVPartThread(void *arg)
+{
+  jtv_multi_part *mp = (jtv_multi_part *)arg;
+
+  mp->tvl = LoadJTVEx(mp->fname, mp->ch_alias, mp->correctTZ, mp->cp_zin_fn,
+                      mp->cp_content, &mp->chl, &mp->opts);
+  return NULL;
+}
+
+// Merge programs of channel chs[i] of lists[i] (-1 if the list hasn't the
+// channel) to the end of list of loader in time order. Of programs
+// starting at the same time only the one of the last list is kept
+static void MergeJTVChannel(jtv_loader *ld, tv_list **lists, int **title_maps,
+                            int *chs, unsigned int *pos, unsigned int count)
+{
+  unsigned int i, *end = pos + count;
+
+  for (i = 0; i < count; i++)
+    if (chs[i] >= 0)
+    {
+      pos[i] = lists[i]->channels[chs[i]].first;
+      end[i] = pos[i] + lists[i]->channels[chs[i]].num;
+    }
+    else
+      pos[i] = end[i] = 0;
+
+  for (;;)
+  {
+    int best = -1;
+    time_t t = 0;
+
+    for (i = 0; i < count; i++)
+      if (pos[i] < end[i] && (best < 0 || lists[i]->tvp[pos[i]].time <= t))
+      {
+        best = i;
+        t = lists[i]->tvp[pos[i]].time;
+      }
+    if (best < 0)
+      break;
+
+    ld->copy_from = lists[best];
+    ld->title_map = title_maps[best];
+    CopyJTVProgram(ld, &lists[best]->tvp[pos[best]]);
+    // drop the same program of other archives
+    for (i = 0; i < count; i++)
+      if (pos[i] < end[i] && lists[i]->tvp[pos[i]].time == t)
+        pos[i]++;
+  }
+}
+
+// Load several archives (overlapping bundles of consecutive weeks) into
+// one list. Programs of equally named channels are merged by time, of
+// programs starting at the same time the one from the archive later in
+// fnames is kept, and etime is fixed across archive boundaries. With
+// threads > 1 archives are loaded in parallel. Channel aliases of the
+// first archive are returned by out_chl, opts->cache isn't used and
+// titles are never lazy. Returns NULL on error
+tv_list *LoadJTVMulti(char **fnames, unsigned int count, char *ch_alias,
+                      int correctTZ, char *cp_zin_fn, char *cp_content,
+                      ch_alias_list **out_chl, jtv_load_opts *opts)
+{
+  int flags = opts ? opts->flags : 0;
+  int threads = opts ? opts->threads : 0;
+  unsigned int i, j, k, num, started = 0, total = 0, title_total = 0;
+  jtv_multi_part *parts;
+  pthread_t *tid = NULL;
+  tv_list **lists, *tvl;
+  int **title_maps, *chs, *map;
+  unsigned int *pos;
+  jtv_loader ld;
+
+  if (out_chl) *out_chl = NULL;
+  // titles are decoded by merging anyway
+  flags &= ~JTV_LOAD_LAZY;
+  if (count == 0 ||
+      (parts = (jtv_multi_part *)calloc(count, sizeof(jtv_multi_part))) == NULL)
+    return NULL;
+  for (i = 0; i < count; i++)
+  {
+    parts[i].fname = fnames[i];
+    parts[i].ch_alias = ch_alias;
+    parts[i].cp_zin_fn = cp_zin_fn;
+    parts[i].cp_content = cp_content;
+    parts[i].correctTZ = correctTZ;
+    parts[i].opts.flags = flags & ~JTV_LOAD_INDEX;
+    parts[i].opts.threads = threads;
+    parts[i].opts.aliases = opts ? opts->aliases : NULL;
+    parts[i].opts.context = opts ? opts->context : NULL;
+    parts[i].opts.from = opts ? opts->from : 0;
+    parts[i].opts.to = opts ? opts->to : 0;
+    parts[i].opts.channels = opts ? opts->channels : NULL;
+    parts[i].opts.channel_num = opts ? opts->channel_num : 0;
+  }
+
+  // load archives, in parallel if threads are allowed
+  if (threads > 1 && count > 1 &&
+      (tid = (pthread_t *)malloc(count * sizeof(pthread_t))) != NULL)
+    for (; started < count; started++)
+    {
+      parts[started].opts.threads = threads / count;
+      if (pthread_create(&tid[started], NULL, LoadJTVPartThread,
+                         &parts[started]) != 0)
+        break;
+    }
+  for (i = started; i < count; i++)
+  {
+    parts[i].opts.threads = threads;
+    LoadJTVPartThread(&parts[i]);
+  }
+  for (i = 0; i < started; i++)
+    pthread_join(tid[i], NULL);
+  free(tid);
+
+  // drop archives which couldn't be loaded
+  lists = (tv_list **)malloc(count * sizeof(tv_list *));
+  for (i = j = 0; lists != NULL && i < count; i++)
+    if (parts[i].tvl != NULL)
+    {
+      lists[j++] = parts[i].tvl;
+      total += parts[i].tvl->num;
+      title_total += parts[i].tvl->title_num;
+    }
+
+  tvl = NewJTV(opts);
+  title_maps = (int **)malloc(count * sizeof(int *));
+  chs = (int *)malloc(count * sizeof(int));
+  pos = (unsigned int *)malloc(count * 2 * sizeof(unsigned int));
+  map = (int *)malloc((title_total + 1) * sizeof(int));
+  if (tvl == NULL || lists == NULL || title_maps == NULL || chs == NULL ||
+      pos == NULL || map == NULL || j == 0 ||
+      !InitJTVLoader(&ld, tvl, correctTZ, opts, &flags))
+  {
+    free(tvl);
+    tvl = NULL;
+  }
+  else
+  {
+    num = j;
+    memset(map, -1, title_total * sizeof(int));
+    for (i = 0; i < num; i++)
+    {
+      title_maps[i] = map;
+      map += lists[i]->title_num;
+    }
+    map = title_maps[0];
+    ReserveJTV(tvl, total);
+
+    // channels in order of their first appearance
+    for (i = 0; i < num; i++)
+      for (k = 0; k < lists[i]->ch_num; k++)
+      {
+        tv_channel *src = &lists[i]->channels[k];
+        // equally named channels of one archive aren't merged (see below)
+        int first = JTVFindChannel(lists[i], src->name) == (int)k;
+        jtv_job job;
+        int ch;
+
+        for (j = 0; first && j < i &&
+               JTVFindChannel(lists[j], src->name) < 0; j++);
+        if (first && j < i)
+          continue; // merged already
+
+        memset(&job, 0, sizeof(job));
+        job.ch_name = PoolStrnew(tvl, src->name, strlen(src->name));
+        job.ch_index = src->ch_index;
+        if (job.ch_name == NULL || (ch = AddJTVChannel(tvl, &job)) < 0)
+          continue;
+        for (j = 0; j < num; j++)
+          chs[j] = j == i ? (int)k : !first || j < i ? -1 :
+            JTVFindChannel(lists[j], src->name);
+        ld.ch_name = job.ch_name;
+        ld.ch_index = job.ch_index;
+        MergeJTVChannel(&ld, lists, title_maps, chs, pos, num);
+        tvl->channels[ch].num = tvl->num - tvl->channels[ch].first;
+      }
+    FinishJTV(tvl, flags);
+    FreeJTVLoader(&ld);
+  }
+
+  for (i = 0; i < count; i++)
+  {
+    FreeJTV(parts[i].tvl);
+    if (i == 0 && out_chl)
+      *out_chl = parts[i].chl;
+    else
+      FreeChannelAliasList(parts[i].chl);
+  }
+  free(map);
+  free(pos);
+  free(chs);
+  free(title_maps);
+  free(lists);
+  free(parts);
   return tvl;
 }
+
+// Decode archive without building a list: cb is called for every program
+// from the parsing loop in archive order (decoding threads of opts are
+// used, callbacks always come from the calling thread). Titles are passed
+// as they are in pdt files, or converted by cnv if it is not NULL.
+// Options flags, window and allow-list apply, JTV_LOAD_DEDUP, LAZY, INDEX
+// and cache are ignored. Nonzero result of cb stops decoding. Returns
+// number of cb calls or -1 on error
+int StreamJTV(char *fname, char *ch_alias, int correctTZ, char *cp_zin_fn,
+              char *cp_content, jtv_load_opts *opts, cp_cnv_t cnv,
+              jtv_record_cb cb, void *data)
+{
+  int flags = opts ? opts->flags : 0;
+  int threads = opts ? opts->threads : 0;
+  int count = -1, shared;
+  pthread_mutex_t *lock;
+  jtv_loader ld;
+  // channel table and names live in a list without programs
+  tv_list *tvl = NewJTV(opts);
+
+  flags &= ~(JTV_LOAD_DEDUP | JTV_LOAD_LAZY | JTV_LOAD_INDEX);
+  if (!tvl) return -1;
+  if (!InitJTVLoader(&ld, tvl, correctTZ, opts, &flags))
+  {
+    free(tvl);
+    return -1;
+  }
+  ld.lookahead = 1;
+  ld.cb = cb;
+  ld.cb_data = data;
+  ld.cnv = cnv;
+  csArchive *jtvFile = JTVOpenArchive(fname, flags);
+
+  ch_alias_list *chl = JTVLoadAliases(opts, ch_alias, cp_zin_fn, cp_content,
+                                      &shared);
+  cp_cnv_t cnv_zip_fn = chl == NULL ? (cp_cnv_t) -1 :
+    JTVOpenZipCnv(opts, chl, &lock);
+  if (cnv_zip_fn != (cp_cnv_t) -1)
+  {
+    jtv_job *jobs;
+    unsigned int num = ScanJTVDirectory(jtvFile, cnv_zip_fn, lock, chl, opts,
+                                        tvl, &jobs);
+
+    LoadJTVChannels(&ld, jtvFile, jobs, num, flags, threads);
+    free(jobs);
+    count = ld.cb_count;
+    JTVCloseZipCnv(cnv_zip_fn, lock);
+  }
+  if (!shared)
+    FreeChannelAliasList(chl);
+  FreeJTVLoader(&ld);
+  FreeJTV(tvl);
+  delete jtvFile;
+  return count;
+}
+
+// Raw title text, lazy titles are taken from their pdt record
+const char *JTVTitleSource(tv_list *tvl, unsigned int id, size_t *len)
+{
+  if (tvl->titles[id] == NULL)
+  {
+    const PDT_RECORD *pdt_rec = (const PDT_RECORD *)tvl->title_src[id];
+    *len = pdt_rec->sz_str;
+    return pdt_rec->str;
+  }
+  *len = strlen(tvl->titles[id]);
+  return tvl->titles[id];
+}
+
+// Title of program. Titles of list loaded with JTV_LOAD_LAZY are decoded
+// (and converted by title_cnv of list, if set) on first access, so the
+// call isn't thread safe for such lists
+char *JTVTitle(tv_list *tvl, tv_program *tvp)
+{
+  unsigned int id = tvp->title_id;
+
+  if (tvp->prg_name == NULL && tvl->titles[id] == NULL)
+  {
+    size_t len, cnv_len = (size_t)-1, scratch_size = 0;
+    const char *str = JTVTitleSource(tvl, id, &len);
+    char *scratch = NULL;
+
+    if (tvl->title_cnv != NULL)
+      cnv_len = CnvJTVString(tvl->title_cnv, str, len,
+                             &scratch, &scratch_size);
+    if (cnv_len != (size_t)-1)
+      tvl->titles[id] = PoolStrnew(tvl, scratch, cnv_len);
+    else
+      tvl->titles[id] = PoolStrnew(tvl, str, len);
+    free(scratch);
+    if (tvl->titles[id] != NULL)
+      tvl->title_src[id] = NULL;
+  }
+  if (tvp->prg_name == NULL)
+    tvp->prg_name = tvl->titles[id];
+  return tvp->prg_name;
+}
+
+// Convert all titles of list by cnv in one pass. Converted titles and
+// channel names are moved into a new string pool which replaces the old
+// one, one scratch buffer is reused for all titles. Titles which can't be
+// converted are kept as is. Returns number of converted titles or -1
+int ConvertJTVTitles(tv_list *tvl, cp_cnv_t cnv)
+{
+  tv_list dst;
+  size_t scratch_size = 0;
+  char *scratch = NULL;
+  unsigned int i, j;
+  int converted = 0, failed = 0;
+
+  memset(&dst, 0, sizeof(dst));
+  dst.pool_block = tvl->pool_block;
+
+  for (i = 0; i < tvl->title_num; i++)
+  {
+    size_t len, cnv_len;
+    const char *str = JTVTitleSource(tvl, i, &len);
+    char *tmp;
+
+    if ((cnv_len = CnvJTVString(cnv, str, len, &scratch, &scratch_size)) !=
+        (size_t)-1)
+    {
+      tmp = PoolStrnew(&dst, scratch, cnv_len);
+      converted++;
+    }
+    else
+      tmp = PoolStrnew(&dst, str, len);
+
+    if (tmp == NULL)
+    {
+      failed = 1;
+      break;
+    }
+    tvl->titles[i] = tmp;
+    if (tvl->title_src != NULL)
+      tvl->title_src[i] = NULL;
+  }
+  free(scratch);
+
+  // programs of channel share its name
+  for (i = 0; i < tvl->ch_num; i++)
+  {
+    tv_channel *ch = &tvl->channels[i];
+    char *name = PoolStrnew(&dst, ch->name, strlen(ch->name));
+
+    if (name == NULL)
+    {
+      failed = 1;
+      continue;
+    }
+    ch->name = name;
+    for (j = ch->first; j < ch->first + ch->num; j++)
+      tvl->tvp[j].ch_name = name;
+  }
+  for (i = 0; i < tvl->num; i++)
+    tvl->tvp[i].prg_name = tvl->titles[tvl->tvp[i].title_id];
+  tvl->converted = 1;
+
+  if (failed)
+  {
+    // out of memory, some strings still live in the old pool, keep it
+    jtv_pool_block **pb = &dst.pool;
+    while (*pb != NULL)
+      pb = &(*pb)->next;
+    *pb = tvl->pool;
+    tvl->pool = dst.pool;
+    return -1;
+  }
+
+  FreePool(tvl->pool);
+  tvl->pool = dst.pool;
+  return converted;
+}
+
+// Create context shared by loads (jtv_load_opts.context): channel aliases
+// are loaded and converter of zip file names is opened once. pool_block is
+// string pool block size of loaded lists (0 - default). Context can be
+// used by several threads at once. Returns NULL on error
+jtv_context *NewJTVContext(char *ch_alias_name, char *cp_zin_fn,
+                           char *cp_content, size_t pool_block)
+{
+  jtv_context *ctx = (jtv_context *)malloc(sizeof(jtv_context));
+  if (ctx == NULL) return NULL;
+
+  ctx->pool_block = pool_block;
+  ctx->aliases = LoadChannelAliasList(ch_alias_name, cp_zin_fn, cp_content);
+  ctx->cnv_zip_fn = ctx->aliases == NULL ? (cp_cnv_t) -1 :
+    cp_cnv_open(nl_langinfo(_NL_MESSAGES_CODESET), ctx->aliases->cp_zip_fn);
+  if (ctx->cnv_zip_fn == (cp_cnv_t) -1)
+  {
+    FreeChannelAliasList(ctx->aliases);
+    free(ctx);
+    return NULL;
+  }
+  pthread_mutex_init(&ctx->lock, NULL);
+  return ctx;
+}
+
+void FreeJTVContext(jtv_context *ctx)
+{
+  if (ctx)
+  {
+    pthread_mutex_destroy(&ctx->lock);
+    cp_cnv_close(ctx->cnv_zip_fn);
+    FreeChannelAliasList(ctx->aliases);
+    free(ctx);
+  }
+}
+
+// Channel aliases of context, codepages of archives are kept there too
+ch_alias_list *JTVContextAliases(jtv_context *ctx)
+{
+  return ctx->aliases;
+}
@@ -1,48 +1,206 @@
 #include <time.h>
+#include "cpconv.h"
 typedef struct {
-  char *ch_name;
-  char *prg_name;
+  char *ch_name;  // strings are kept in string pool of tv_list,
+  char *prg_name; // don't free them, use FreeJTV for whole list
+                  // (NULL until JTVTitle call for JTV_LOAD_LAZY lists)
   int ch_index;
   time_t time;
   time_t etime;
-  int index_time;  // sort index by time  (fills not lib, but application)
-  int index_etime; // sort index by etime
+  int index_time;  // position-sorted index by start time (filled by
+                   // BuildJTVIndex): tvp[tvp[k].index_time] is k-th program
+  int index_etime; // position-sorted index by end time (filled by
+                   // BuildJTVIndex)
+  unsigned int title_id; // index of prg_name in titles table of tv_list
 //  int tm_isdst;
 } tv_program;
 
+// columnar copy of programs for fast time scans (see BuildJTVColumns),
+// item i of each column belongs to program i of tv_list
+typedef struct {
+  unsigned int num;
+  time_t base;   // times are kept as 32 bit offsets from base
+  int *time;
+  int *etime;
+  int *ch_index;
+  unsigned int *title_id;
+} tv_columns;
+
+// channel of tv_list, its programs are tvp[first] .. tvp[first + num - 1]
+typedef struct {
+  char *name;   // channel name (or alias), the same string as ch_name
+  int ch_index; // alias index, -1 if channel has no alias
+  unsigned int first;
+  unsigned int num;
+  unsigned int ndx_crc, pdt_crc;   // CRC32 and sizes of channel files in
+  unsigned int ndx_size, pdt_size; // archive, to find changes (ReloadJTV)
+} tv_channel;
+
 typedef struct {
   unsigned int num;
   tv_program *tvp;
+  unsigned int cap; // number of allocated tvp items
+  struct jtv_pool_block *pool; // string pool (chain of blocks)
+  unsigned int title_num; // number of unique titles
+  unsigned int title_cap; // number of allocated titles items
+  char **titles; // interned titles, programs refer them by title_id
+  const char **title_src; // pdt records of not decoded titles (JTV_LOAD_LAZY)
+  unsigned int buff_num; // number of pdt files kept for lazy titles
+  char **buffs;          // pdt files kept for lazy titles
+  cp_cnv_t title_cnv; // converter of lazy titles, set by application
+                      // (not closed by FreeJTV)
+  tv_columns *cols; // columns of programs, NULL until BuildJTVColumns
+  unsigned int index_num; // number of programs sorted by BuildJTVIndex
+  struct jtv_airing_index *airing; // time buckets index of programs,
+                                   // NULL until BuildJTVAiringIndex
+  unsigned int ch_num; // number of channels
+  unsigned int ch_cap; // number of allocated channels items
+  tv_channel *channels; // channels in archive order
+  unsigned int ch_hash_size;
+  unsigned int *ch_hash; // channel number + 1 by name hash
+  char *snap;       // mapped snapshot holding programs, titles, channels
+  size_t snap_size; // and strings of list (LoadJTVSnapshot), or NULL
+  int correctTZ; // time zone correction programs were loaded with
+  size_t pool_block; // size of string pool blocks, 0 - default
+  time_t from, to; // time window programs were loaded with
+  int converted; // titles were converted by ConvertJTVTitles (ReloadJTV)
 } tv_list;
 
+// result of queries of list whose index or columns weren't built (or the
+// list was changed since), distinct from any number of found programs
+#define JTV_NOT_INDEXED ((unsigned int)-1)
+
+// called by JTVAiringBetween for every found program, nonzero result
+// stops search
+typedef int (*jtv_airing_cb)(tv_list *tvl, unsigned int index, void *data);
+
+// called by StreamJTV for every program, title of title_len chars isn't
+// 0 terminated and is valid during the call only, nonzero result stops
+// decoding
+typedef int (*jtv_record_cb)(const char *ch_name, int ch_index, time_t start,
+                             time_t end, const char *title, size_t title_len,
+                             void *data);
+
 typedef struct {
   char *zip_name;
   char *real_name;
 } ch_alias;
 
+/* LoadJTVEx flags */
+#define JTV_LOAD_STREAM 0x0001 // inflate .ndx files by small windows while parsing
+#define JTV_LOAD_DEDUP  0x0002 // share equal titles between all channels
+#define JTV_LOAD_LAZY   0x0004 // keep pdt files and decode titles on first
+                               // access by JTVTitle, JTV_LOAD_DEDUP is ignored
+#define JTV_LOAD_INDEX  0x0008 // fill index_time and index_etime of programs
+#define JTV_LOAD_STDIO  0x0010 // read archive through stdio instead of mapping
+                               // it: archive truncated or rewritten in place
+                               // while loading is a read error, not SIGBUS
+                               // (replace mapped archives by rename)
+
+// extended load options, zero filled structure means default behaviour
+typedef struct ch_alias_list_s ch_alias_list;
+typedef struct jtv_context_s jtv_context;
+
+typedef struct {
+  int flags; // JTV_LOAD_xxx
+  int threads; // number of threads decoding channels (0 or 1 - no threads),
+               // JTV_LOAD_STREAM is ignored when threads are used
+  const char *cache; // snapshot file name: the list is loaded from it when
+                     // it was made from the same archive with the same
+                     // parameters, otherwise it is rewritten after loading.
+                     // Titles of snapshot are never lazy
+  ch_alias_list *aliases; // channel aliases loaded once by
+                          // LoadChannelAliasList and shared by loads:
+                          // alias file and codepage arguments are ignored,
+                          // out_chl is set to NULL (the list isn't freed)
+  jtv_context *context; // shared aliases, converters and pool settings
+                        // (NewJTVContext), replaces aliases and arguments
+                        // as above
+  time_t from, to; // window: only programs airing in [from, to) are
+                   // loaded (to == 0 - no upper bound), both 0 - all
+  const char **channels;    // allow-list of channels by zip file name
+                            // (without extension) or alias, ASCII case
+                            // insensitive: files of other channels are
+                            // never read. NULL - all channels
+  unsigned int channel_num; // number of channels in allow-list
+} jtv_load_opts;
+
+// identity of archive and load parameters snapshot was made from
+typedef struct {
+  unsigned long long arc_size;
+  long long arc_mtime;
+  unsigned int dir_crc;  // CRC of archive directory (file names and CRCs)
+  unsigned int opts_crc; // CRC of load parameters and channel aliases
+} jtv_snap_key;
+
 #define CP_ZIP_FN_ALLOC 1
 #define CP_CONTENT_ALLOC 2
 
-typedef struct {
+struct ch_alias_list_s {
   unsigned int num;
   char *cp_zip_fn; // codepage for zip filenames
   char *cp_content; // codepage for content of files
   char cp_flags; // for check allocation codepage strings
+  unsigned int hash_size;
+  unsigned int *hash; // alias number + 1 by hash of zip_name (ASCII case
+                      // folded), NULL if aliases are searched linearly
   ch_alias cha[];
-} ch_alias_list;
+};
 
 #ifdef __cplusplus
 extern "C" tv_list * LoadJTV(char *fname, char *ch_alias_name, int correctTZ, char *cp_zin_fn, char *cp_content, ch_alias_list **out_chl);
+extern "C" tv_list * LoadJTVEx(char *fname, char *ch_alias_name, int correctTZ, char *cp_zin_fn, char *cp_content, ch_alias_list **out_chl, jtv_load_opts *opts);
+extern "C" tv_list * LoadJTVMulti(char **fnames, unsigned int count, char *ch_alias_name, int correctTZ, char *cp_zin_fn, char *cp_content, ch_alias_list **out_chl, jtv_load_opts *opts);
+extern "C" int StreamJTV(char *fname, char *ch_alias_name, int correctTZ, char *cp_zin_fn, char *cp_content, jtv_load_opts *opts, cp_cnv_t cnv, jtv_record_cb cb, void *data);
+extern "C" int ReloadJTV(tv_list *tvl, char *fname, char *ch_alias_name, int correctTZ, char *cp_zin_fn, char *cp_content, jtv_load_opts *opts, cp_cnv_t cnv);
 extern "C" void FreeJTV(tv_list *tvl);
 extern "C" ch_alias_list *LoadChannelAliasList(char *fname, char *cp_zin_fn, char *cp_content);
 extern "C" void FreeChannelAliasList(ch_alias_list *ch_list);
+extern "C" jtv_context *NewJTVContext(char *ch_alias_name, char *cp_zin_fn, char *cp_content, size_t pool_block);
+extern "C" void FreeJTVContext(jtv_context *ctx);
+extern "C" ch_alias_list *JTVContextAliases(jtv_context *ctx);
 extern "C" char *strnewcnv(iconv_t cnv, char *str);
+extern "C" int ConvertJTVTitles(tv_list *tvl, cp_cnv_t cnv);
+extern "C" char *JTVTitle(tv_list *tvl, tv_program *tvp);
+extern "C" int JTVFindChannel(tv_list *tvl, const char *name);
+extern "C" tv_program *JTVChannelSpan(tv_list *tvl, unsigned int ch, unsigned int *num);
+extern "C" int SaveJTVSnapshot(tv_list *tvl, const char *fname, const jtv_snap_key *key);
+extern "C" tv_list *LoadJTVSnapshot(const char *fname, const jtv_snap_key *key);
+extern "C" int BuildJTVColumns(tv_list *tvl);
+extern "C" unsigned int JTVProgramsBetween(tv_list *tvl, time_t from, time_t to, unsigned int *idx, unsigned int max);
+extern "C" int BuildJTVIndex(tv_list *tvl);
+extern "C" unsigned int JTVFirstStartAfter(tv_list *tvl, time_t t);
+extern "C" unsigned int JTVFirstEndAfter(tv_list *tvl, time_t t);
+extern "C" int BuildJTVAiringIndex(tv_list *tvl);
+extern "C" unsigned int JTVAiringAt(tv_list *tvl, time_t t, unsigned int *idx, unsigned int max);
+extern "C" unsigned int JTVAiringBetween(tv_list *tvl, time_t from, time_t to, jtv_airing_cb cb, void *data);
 #else
 extern tv_list * LoadJTV(char *fname, char *ch_alias_name, int correctTZ, char *cp_zin_fn, char *cp_content, ch_alias_list **out_chl);
+extern tv_list * LoadJTVEx(char *fname, char *ch_alias_name, int correctTZ, char *cp_zin_fn, char *cp_content, ch_alias_list **out_chl, jtv_load_opts *opts);
+extern tv_list * LoadJTVMulti(char **fnames, unsigned int count, char *ch_alias_name, int correctTZ, char *cp_zin_fn, char *cp_content, ch_alias_list **out_chl, jtv_load_opts *opts);
+extern int StreamJTV(char *fname, char *ch_alias_name, int correctTZ, char *cp_zin_fn, char *cp_content, jtv_load_opts *opts, cp_cnv_t cnv, jtv_record_cb cb, void *data);
+extern int ReloadJTV(tv_list *tvl, char *fname, char *ch_alias_name, int correctTZ, char *cp_zin_fn, char *cp_content, jtv_load_opts *opts, cp_cnv_t cnv);
 extern void FreeJTV(tv_list *tvl);
 extern ch_alias_list *LoadChannelAliasList(char *fname, char *cp_zin_fn, char *cp_content);
 extern void FreeChannelAliasList(ch_alias_list *ch_list);
+extern jtv_context *NewJTVContext(char *ch_alias_name, char *cp_zin_fn, char *cp_content, size_t pool_block);
+extern void FreeJTVContext(jtv_context *ctx);
+extern ch_alias_list *JTVContextAliases(jtv_context *ctx);
 extern char *strnewcnv(iconv_t cnv, char *str);
+extern int ConvertJTVTitles(tv_list *tvl, cp_cnv_t cnv);
+extern char *JTVTitle(tv_list *tvl, tv_program *tvp);
+extern int JTVFindChannel(tv_list *tvl, const char *name);
+extern tv_program *JTVChannelSpan(tv_list *tvl, unsigned int ch, unsigned int *num);
+extern int SaveJTVSnapshot(tv_list *tvl, const char *fname, const jtv_snap_key *key);
+extern tv_list *LoadJTVSnapshot(const char *fname, const jtv_snap_key *key);
+extern int BuildJTVColumns(tv_list *tvl);
+extern unsigned int JTVProgramsBetween(tv_list *tvl, time_t from, time_t to, unsigned int *idx, unsigned int max);
+extern int BuildJTVIndex(tv_list *tvl);
+extern unsigned int JTVFirstStartAfter(tv_list *tvl, time_t t);
+extern unsigned int JTVFirstEndAfter(tv_list *tvl, time_t t);
+extern int BuildJTVAiringIndex(tv_list *tvl);
+extern unsigned int JTVAiringAt(tv_list *tvl, time_t t, unsigned int *idx, unsigned int max);
+extern unsigned int JTVAiringBetween(tv_list *tvl, time_t from, time_t to, jtv_airing_cb cb, void *data);
 #endif
 
 #define CHANNEL_ALIAS_LIST "channel.alias.rc"
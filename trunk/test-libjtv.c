@@ -20,10 +20,10 @@ int main(int argc, char *argv[])
   }
 
   ch_alias_list *chl;
-  unsigned int i;
+  unsigned int c, i;
   int cur_day = -1;
-  char *cur_ch = "";
-  iconv_t cnv_zip_fn, cnv_content;
+  iconv_t cnv_zip_fn;
+  cp_cnv_t cnv_content;
 
   //= LoadChannelAliasList(CHANNEL_ALIAS_LIST, NULL, NULL);
 
@@ -33,14 +33,16 @@ int main(int argc, char *argv[])
 
   tv_list *tvl = LoadJTV(argv[1],CHANNEL_ALIAS_LIST, 0, NULL, NULL, &chl);
 
-  cnv_content = iconv_open(nl_langinfo(_NL_MESSAGES_CODESET),
-                                   chl->cp_content);
-  if (cnv_content == (iconv_t) -1)
+  cnv_content = cp_cnv_open(nl_langinfo(_NL_MESSAGES_CODESET),
+                            chl->cp_content);
+  if (cnv_content == (cp_cnv_t) -1)
   {
     printf("Iconv open return %d error code\n", errno);
     ret = errno;
     goto g_free_jtv;
   }
+  // convert all titles at once instead of strnewcnv for every program
+  ConvertJTVTitles(tvl, cnv_content);
 
   cnv_zip_fn = iconv_open(nl_langinfo(_NL_MESSAGES_CODESET),
                                   chl->cp_zip_fn);
@@ -51,36 +53,35 @@ int main(int argc, char *argv[])
     goto g_free_content;
   }
 
-  for (i = 0; i < tvl->num; i++)
+  for (c = 0; c < tvl->ch_num; c++)
   {
-    struct tm *tmp;
-    char *pn;
-    tmp = localtime(&tvl->tvp[i].time);
-    if (strcmp(tvl->tvp[i].ch_name, cur_ch) != 0)
+    unsigned int num;
+    tv_program *tvp = JTVChannelSpan(tvl, c, &num);
+
+    //printf("Channel %s : ", strnewcnv(cnv_zip_fn,tvl->channels[c].name));
+    printf("Channel %s\n", tvl->channels[c].name);
+    for (i = 0; i < num; i++)
     {
-      cur_ch = tvl->tvp[i].ch_name;
-      //printf("Channel %s : ", strnewcnv(cnv_zip_fn,cur_ch));
-      printf("Channel %s\n", cur_ch);
-    }
+      struct tm *tmp;
+      tmp = localtime(&tvp[i].time);
 #if 0
-    char tbuf[100];
-    if (cur_day != tmp->tm_mday)
-    {
-      strftime(tbuf,100,date_format,tmp);
-      printf("%s\n", tbuf);
-      cur_day = tmp->tm_mday;
-    }
+      char tbuf[100];
+      if (cur_day != tmp->tm_mday)
+      {
+        strftime(tbuf,100,date_format,tmp);
+        printf("%s\n", tbuf);
+        cur_day = tmp->tm_mday;
+      }
 
-    strftime(tbuf,100,time_format,tmp);
-    pn = strnewcnv(cnv_content, tvl->tvp[i].prg_name);
-    printf("%s %s\n",
-           tbuf,pn);
-    free(pn);
+      strftime(tbuf,100,time_format,tmp);
+      printf("%s %s\n",
+             tbuf,tvp[i].prg_name);
 #endif
+    }
   }
   iconv_close(cnv_zip_fn);
   g_free_content:
-  iconv_close(cnv_content);
+  cp_cnv_close(cnv_content);
   g_free_jtv:
   FreeChannelAliasList(chl);
   FreeJTV(tvl);